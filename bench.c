@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <X11/Xlib.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+#include "sview.h"
+#include "sview_convert.h"
+
+/*
+ * Compare uploading SVIEW_PIXFMT_RGB / SVIEW_PIXFMT_I as-is (letting
+ * the driver convert) with converting to BGRA ourselves first
+ */
+
+static const struct {
+  unsigned int width, height;
+} sizes[] = {
+  {640, 480},
+  {1920, 1080},
+  {3840, 2160},
+};
+
+static const struct {
+  sview_pixfmt_t pixfmt;
+  const char *name;
+} formats[] = {
+  {SVIEW_PIXFMT_RGB, "RGB"},
+  {SVIEW_PIXFMT_I,   "I"},
+};
+
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int
+iterations_for(const sview_picture_t *sp)
+{
+  return 2 + (200 * 1000 * 1000) / (sp->width * sp->height * 10);
+}
+
+
+static double
+bench_convert(const sview_picture_t *sp, uint8_t *dst,
+              convert_impl_t impl, int threads)
+{
+  const int iterations = iterations_for(sp);
+  convert_to_bgra(sp, dst, sp->width * 4, impl, threads);
+  const double t0 = now();
+  for(int i = 0; i < iterations; i++)
+    convert_to_bgra(sp, dst, sp->width * 4, impl, threads);
+  return (now() - t0) / iterations;
+}
+
+
+static void
+upload_driver(const sview_picture_t *sp)
+{
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  if(sp->pixfmt == SVIEW_PIXFMT_RGB)
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, sp->width, sp->height,
+                 0, GL_RGB, GL_UNSIGNED_BYTE, sp->planes[0]);
+  else
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY, sp->width, sp->height,
+                 0, GL_RED, GL_UNSIGNED_BYTE, sp->planes[0]);
+}
+
+
+static void
+upload_converted(const sview_picture_t *sp, uint8_t *buf)
+{
+  convert_to_bgra(sp, buf, sp->width * 4, CONVERT_SIMD, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sp->width, sp->height,
+               0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, buf);
+}
+
+
+static double
+bench_upload(const sview_picture_t *sp, uint8_t *buf, int converted)
+{
+  const int iterations = iterations_for(sp);
+  double t0 = 0;
+  for(int i = -1; i < iterations; i++) {
+    if(i == 0) {
+      glFinish();
+      t0 = now();
+    }
+    if(converted)
+      upload_converted(sp, buf);
+    else
+      upload_driver(sp);
+  }
+  glFinish();
+  return (now() - t0) / iterations;
+}
+
+
+static int
+gl_init(void)
+{
+  Display *dpy = XOpenDisplay(NULL);
+  if(dpy == NULL)
+    return -1;
+
+  GLint att[] = { GLX_RGBA, None };
+  XVisualInfo *vi = glXChooseVisual(dpy, 0, att);
+  if(vi == NULL)
+    return -1;
+
+  Window root = DefaultRootWindow(dpy);
+  XSetWindowAttributes swa = {
+    .colormap = XCreateColormap(dpy, root, vi->visual, AllocNone),
+  };
+  Window win = XCreateWindow(dpy, root, 0, 0, 16, 16, 0, vi->depth,
+                             InputOutput, vi->visual, CWColormap, &swa);
+  GLXContext glc = glXCreateContext(dpy, vi, NULL, GL_TRUE);
+  if(glc == NULL || !glXMakeCurrent(dpy, win, glc))
+    return -1;
+
+  printf("GL renderer: %s\n", glGetString(GL_RENDERER));
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  return 0;
+}
+
+
+int
+main(void)
+{
+  printf("Vector kernels: %s\n\n", convert_simd_name());
+
+  const int have_gl = gl_init() == 0;
+  if(!have_gl)
+    printf("No GLX display available, skipping upload benchmark\n\n");
+
+  printf("%-4s %-10s %10s %10s %10s", "fmt", "size",
+         "scalar", "simd", "simd-mt");
+  if(have_gl)
+    printf(" %12s %12s", "upload-drv", "upload-conv");
+  printf("    (ms per frame)\n");
+
+  for(int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      sview_picture_t *sp = sview_picture_alloc(sizes[s].width,
+                                                sizes[s].height,
+                                                formats[f].pixfmt, 0);
+      const size_t srcsize = sp->strides[0] * sp->height;
+      for(size_t i = 0; i < srcsize; i++)
+        sp->planes[0][i] = rand();
+
+      const size_t dstsize = sp->width * 4 * sp->height;
+      uint8_t *ref = malloc(dstsize);
+      uint8_t *dst = malloc(dstsize);
+
+      const double scalar = bench_convert(sp, ref, CONVERT_SCALAR, 1);
+      const double simd   = bench_convert(sp, dst, CONVERT_SIMD, 1);
+      if(memcmp(ref, dst, dstsize)) {
+        fprintf(stderr, "%s kernel output differs from scalar\n",
+                convert_simd_name());
+        exit(1);
+      }
+      const double simd_mt = bench_convert(sp, dst, CONVERT_SIMD, 0);
+      if(memcmp(ref, dst, dstsize)) {
+        fprintf(stderr, "Threaded conversion differs from scalar\n");
+        exit(1);
+      }
+
+      char size[32];
+      snprintf(size, sizeof(size), "%ux%u", sp->width, sp->height);
+      printf("%-4s %-10s %10.3f %10.3f %10.3f", formats[f].name, size,
+             scalar * 1000, simd * 1000, simd_mt * 1000);
+      if(have_gl)
+        printf(" %12.3f %12.3f",
+               bench_upload(sp, dst, 0) * 1000,
+               bench_upload(sp, dst, 1) * 1000);
+      printf("\n");
+
+      free(ref);
+      free(dst);
+      sp->release(sp);
+    }
+  }
+  return 0;
+}
@@ -4,9 +4,13 @@
 
 
 int
-main(void)
+main(int argc, char **argv)
 {
-  sview_t *sv = sview_create("test", 640, 480);
+  sview_t *sv = sview_create("test", 640, 480, NULL);
+
+  // Optionally display pictures from other processes too
+  if(argc > 1)
+    sview_shm_serve(sv, argv[1]);
 
   sview_picture_t *sp = sview_picture_alloc(640, 480, SVIEW_PIXFMT_BGRA, 1);
   uint8_t *x = sp->planes[0];
@@ -17,6 +21,6 @@ main(void)
     x[i * 4 + 3] = i * 7;
   }
 
-  sview_put_picture(sv, 0, 0, sp, "This is a test");
+  sview_put_picture(sv, 0, 0, sp, "This is a test", 0, 0);
   pause();
 }
@@ -2,29 +2,132 @@
 #include <sys/queue.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#include <X11/keysym.h>
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glx.h>
+#include <GL/glxext.h>
 #include <GL/glu.h>
 
 #include "sview.h"
+#include "sview_convert.h"
 #include "font8x8_basic.h"
 
 TAILQ_HEAD(img_cell_queue, img_cell);
+TAILQ_HEAD(widget_state_queue, widget_state);
+
+typedef struct rect {
+  int left, top, right, bottom;
+} rect_t;
+
+
+// Number of previous frames we keep damage for, older back buffers
+// are redrawn in full
+#define DAMAGE_HISTORY 4
+
+// Idle rendering loop still checks for changed widget values this often
+#define IDLE_POLL_MS 50
+
+// How often the render thread gives back conversion memory it hasn't
+// needed lately
+#define SCRATCH_TRIM_MS 2000
+
+// Cells are never shrunk below this when evicted
+#define TEX_PROXY_MIN_SIZE 64
+
+// Cells not drawn for this long are shrunk to TEX_PROXY_MIN_SIZE
+#define TEX_EVICT_AGE_MS 1000
+
+/**
+ * Set once the render thread's context is current. With texture_rg and
+ * texture_swizzle, SVIEW_PIXFMT_I is stored one byte per texel in a
+ * GL_R8 texture that samples as I,I,I,I, otherwise it's expanded to
+ * BGRA on the CPU
+ */
+static __thread int gl_single_channel;
+
+TAILQ_HEAD(region_queue, region);
+
+/**
+ * Pending update of part of a cell's picture
+ */
+typedef struct region {
+  TAILQ_ENTRY(region) r_link;
+  rect_t r_rect;            // In picture coordinates
+  sview_pixfmt_t r_pixfmt;
+  uint8_t *r_data;
+  int r_stride;             // Rows are tightly packed
+  int r_capacity;           // Rows allocated in r_data
+} region_t;
 
 
 typedef struct tex {
   uint32_t t_texture;
-  unsigned int t_width;
+  unsigned int t_width;   // Size of picture
   unsigned int t_height;
+  int t_level;            // Texture is picture size >> t_level
+  int t_channels;         // Bytes per texel, 1 (GL_R8) or 4 (GL_RGBA8)
+  uint8_t *t_backing;     // Full size texels kept while t_level > 0
+  sview_pixfmt_t t_pixfmt;
   sview_picture_t *t_source;
 } tex_t;
 
 
+/**
+ * Texture of a picture from sview_picture_share(), used by all cells
+ * that show it. Holds a reference on the picture, which is also what
+ * identifies it
+ */
+typedef struct shared_tex {
+  LIST_ENTRY(shared_tex) st_link;
+  sview_picture_t *st_picture;
+  tex_t st_tex;
+  int st_refs;             // Cells using it
+} shared_tex_t;
+
+LIST_HEAD(shared_tex_list, shared_tex);
+
+
+/**
+ * Copy of a picture a cell has shown, possibly at reduced resolution
+ */
+typedef struct history_frame {
+  TAILQ_ENTRY(history_frame) hf_link;
+  sview_picture_t *hf_picture;  // Picture size >> hf_shift
+  unsigned int hf_width;        // Size of original picture
+  unsigned int hf_height;
+  int hf_shift;
+  unsigned int hf_seq;
+} history_frame_t;
+
+TAILQ_HEAD(history_frame_queue, history_frame);
+
+typedef struct history {
+  struct history_frame_queue h_frames;  // Newest first
+  int h_count;
+  size_t h_bytes;
+  unsigned int h_seq;
+
+  int h_paused;
+  int h_index;             // Frame shown when paused, 0 is newest
+  unsigned int h_shown;    // hf_seq of frame in h_tex
+  tex_t h_tex;
+  tex_t h_label;
+} history_t;
+
+
 typedef struct img_cell {
 
   TAILQ_ENTRY(img_cell) ic_link;
@@ -33,11 +136,66 @@ typedef struct img_cell {
   unsigned int ic_row;
 
   tex_t ic_content;
+  shared_tex_t *ic_shared;  // ic_content is a copy of its st_tex
   tex_t ic_overlay;
 
   int ic_flags;
   int ic_grid_size;
 
+  // What a pending cell carries, see copy_pending_cells()
+  int ic_pending;
+#define PENDING_PICTURE 0x1
+#define PENDING_REGIONS 0x2
+#define PENDING_COMPARE 0x4
+#define PENDING_COLORMAP 0x8
+#define PENDING_HISTORY 0x10
+
+  struct region_queue ic_regions;
+
+  unsigned int ic_generation;  // Bumped whenever content changes
+
+  // Cell shows a comparison of two other cells instead of a picture
+  const sview_compare_t *ic_compare;
+  struct img_cell *ic_cmp_a;
+  struct img_cell *ic_cmp_b;
+  unsigned int ic_cmp_a_generation;
+  unsigned int ic_cmp_b_generation;
+  sview_compare_t ic_cmp_state;    // As last drawn
+  int ic_cmp_phase;                // Which of A/B is shown when flickering
+
+  // Applied to SVIEW_PIXFMT_I pictures. A user table (ic_lut, 256 RGB
+  // entries) overrides the built-in colormap
+  sview_colormap_t ic_colormap;
+  uint8_t *ic_lut;
+  int ic_lut_dirty;
+  GLuint ic_lut_texture;
+
+  // History of shown pictures, see sview_set_history()
+  int ic_history_frames;
+  size_t ic_history_bytes;
+  int ic_history_shift;
+  int ic_history_changed;
+  history_t *ic_history;
+  history_frame_t *ic_history_frame;  // Copy of the pending picture
+
+  int ic_dirty;
+  rect_t ic_rect;     // Grid slot on screen
+  rect_t ic_inner;    // Picture within ic_rect
+  rect_t ic_extent;   // Everything drawn for the cell, overlay included
+
+  // For texture budget
+  int64_t ic_last_update;
+  int64_t ic_last_drawn;
+  int ic_screen_width;
+  int ic_screen_height;
+
+  // As seen by sview_get_cell_viewport(), protected by sv_cell_mutex
+  sview_viewport_t ic_viewport;
+
+  // Viewport callback pending, protected by sv_dispatch_mutex
+  TAILQ_ENTRY(img_cell) ic_viewport_link;
+  int ic_viewport_queued;
+
 } img_cell_t;
 
 
@@ -53,11 +211,72 @@ struct sview {
   struct img_cell_queue sv_pending_cells;
 
   sview_widget_t *sv_widgets;
-};
 
-typedef struct rect {
-  int left, top, right, bottom;
-} rect_t;
+  // Widget callbacks are run on a separate thread so a slow callback
+  // never stalls rendering
+  pthread_mutex_t sv_dispatch_mutex;
+  pthread_cond_t sv_dispatch_cond;
+  struct widget_state_queue sv_dispatch_queue;
+  struct img_cell_queue sv_viewport_queue;
+  int sv_dispatch_running;
+
+  sview_viewport_callback_t *sv_viewport_cb;
+  void *sv_viewport_opaque;
+
+  int sv_win_visible;
+
+  int64_t sv_frame_time; // Monotonic ms at start of current frame
+
+  int sv_wakeup_fd;
+
+  int sv_win_width;
+  int sv_win_height;
+  int sv_num_cols;
+  int sv_num_rows;
+  rect_t sv_widget_rect;
+  int sv_widget_col1;
+  int sv_num_widgets;
+  rect_t sv_widget_area;   // sv_widget_rect minus border
+  int sv_widget_scroll;    // First row requested by scrolling
+  int sv_widget_first;     // First row shown
+  int sv_widget_rows;      // Rows that fit
+  sview_widget_t *sv_widget_hover;
+  sview_widget_t *sv_widget_grab;
+
+  // Area that needs to be redrawn, and what was redrawn in previous
+  // frames for GLX_EXT_buffer_age
+  rect_t sv_damage;
+  rect_t sv_damage_history[DAMAGE_HISTORY];
+  enum {
+    PRESENT_SWAP,
+    PRESENT_BUFFER_AGE,
+    PRESENT_COPY_SUB_BUFFER,
+  } sv_present;
+  PFNGLXCOPYSUBBUFFERMESAPROC sv_copy_sub_buffer;
+
+  // Wake up this often even if idle, for time based effects
+  int sv_idle_poll_ms;
+
+  GLuint sv_compare_program;
+  GLint sv_compare_u_mode;
+  GLint sv_compare_u_threshold;
+  GLint sv_compare_u_amount;
+
+  GLuint sv_colormap_program;
+  GLuint sv_colormaps[SVIEW_COLORMAP_INFERNO + 1];
+
+  size_t sv_tex_budget;
+  size_t sv_tex_resident;
+  unsigned int sv_tex_evictions;
+  unsigned int sv_tex_demotions;
+  unsigned int sv_tex_restores;
+  size_t sv_tex_backing;
+
+  struct shared_tex_list sv_shared_textures;
+
+  size_t sv_history_resident;
+  unsigned int sv_history_frames;
+};
 
 typedef struct rgb {
   float r,g,b;
@@ -79,6 +298,52 @@ rect_pad(const rect_t src, int left, int top, int right, int bottom)
 }
 
 
+static int
+rect_empty(const rect_t r)
+{
+  return r.right <= r.left || r.bottom <= r.top;
+}
+
+static rect_t
+rect_union(const rect_t a, const rect_t b)
+{
+  if(rect_empty(a))
+    return b;
+  if(rect_empty(b))
+    return a;
+  return (rect_t){MIN(a.left, b.left), MIN(a.top, b.top),
+      MAX(a.right, b.right), MAX(a.bottom, b.bottom)};
+}
+
+static rect_t
+rect_intersect(const rect_t a, const rect_t b)
+{
+  const rect_t r = {MAX(a.left, b.left), MAX(a.top, b.top),
+                    MIN(a.right, b.right), MIN(a.bottom, b.bottom)};
+  return rect_empty(r) ? (rect_t){0,0,0,0} : r;
+}
+
+static int
+rect_eq(const rect_t a, const rect_t b)
+{
+  return a.left == b.left && a.top == b.top &&
+    a.right == b.right && a.bottom == b.bottom;
+}
+
+
+static void
+damage_add(sview_t *sv, const rect_t r)
+{
+  sv->sv_damage = rect_union(sv->sv_damage, r);
+}
+
+static void
+damage_all(sview_t *sv)
+{
+  damage_add(sv, (rect_t){0, 0, sv->sv_win_width, sv->sv_win_height});
+}
+
+
 static rect_t
 rect_fit(const tex_t *t, const rect_t rect)
 {
@@ -241,6 +506,311 @@ tex_source_free(tex_t *t)
 }
 
 
+static int
+rect_contains(const rect_t outer, const rect_t inner)
+{
+  return inner.left >= outer.left && inner.right <= outer.right &&
+    inner.top >= outer.top && inner.bottom <= outer.bottom;
+}
+
+
+static region_t *
+region_create(const rect_t rect, sview_pixfmt_t pixfmt,
+              const uint8_t *data, int stride)
+{
+  const int bpp = sview_pixfmt_bpp(pixfmt);
+  const int height = rect.bottom - rect.top;
+  region_t *r = calloc(1, sizeof(region_t));
+  r->r_rect = rect;
+  r->r_pixfmt = pixfmt;
+  r->r_stride = (rect.right - rect.left) * bpp;
+  r->r_capacity = height;
+  r->r_data = malloc((size_t)r->r_stride * height);
+  for(int y = 0; y < height; y++)
+    memcpy(r->r_data + y * r->r_stride, data + y * stride, r->r_stride);
+  return r;
+}
+
+
+static void
+region_free(region_t *r)
+{
+  free(r->r_data);
+  free(r);
+}
+
+
+static void
+region_queue_flush(struct region_queue *q)
+{
+  region_t *r;
+  while((r = TAILQ_FIRST(q)) != NULL) {
+    TAILQ_REMOVE(q, r, r_link);
+    region_free(r);
+  }
+}
+
+
+/**
+ * Copy the part of 'src' that lies within 'dst'
+ */
+static void
+region_blit(region_t *dst, const region_t *src)
+{
+  const rect_t c = rect_intersect(dst->r_rect, src->r_rect);
+  const int bpp = sview_pixfmt_bpp(dst->r_pixfmt);
+  const size_t rowsize = (c.right - c.left) * bpp;
+  for(int y = c.top; y < c.bottom; y++)
+    memcpy(dst->r_data + (y - dst->r_rect.top) * dst->r_stride +
+           (c.left - dst->r_rect.left) * bpp,
+           src->r_data + (y - src->r_rect.top) * src->r_stride +
+           (c.left - src->r_rect.left) * bpp,
+           rowsize);
+}
+
+
+/**
+ * Returns 1 if 'a' and 'b' together cover exactly their bounding box
+ */
+static int
+region_mergeable(const rect_t a, const rect_t b)
+{
+  if(a.left == b.left && a.right == b.right)
+    return b.top <= a.bottom && b.bottom >= a.top;
+  if(a.top == b.top && a.bottom == b.bottom)
+    return b.left <= a.right && b.right >= a.left;
+  return 0;
+}
+
+
+/**
+ * Merge 'n' into 'r', 'n' being the newer of the two
+ */
+static void
+region_merge(region_t *r, const region_t *n)
+{
+  const rect_t u = rect_union(r->r_rect, n->r_rect);
+  const int bpp = sview_pixfmt_bpp(r->r_pixfmt);
+  const int stride = (u.right - u.left) * bpp;
+  const int height = u.bottom - u.top;
+
+  if(u.top == r->r_rect.top && stride == r->r_stride) {
+    // Growing downwards, typically line scan cameras. Extend in place
+    if(height > r->r_capacity) {
+      r->r_capacity = MAX(height, r->r_capacity * 2);
+      r->r_data = realloc(r->r_data, (size_t)stride * r->r_capacity);
+    }
+    r->r_rect = u;
+    region_blit(r, n);
+    return;
+  }
+
+  region_t old = *r;
+  r->r_rect = u;
+  r->r_stride = stride;
+  r->r_capacity = height;
+  r->r_data = malloc((size_t)stride * height);
+  region_blit(r, &old);
+  region_blit(r, n);
+  free(old.r_data);
+}
+
+
+static int
+region_overlaps_later(const region_t *r, const rect_t rect)
+{
+  while((r = TAILQ_NEXT(r, r_link)) != NULL) {
+    if(!rect_empty(rect_intersect(r->r_rect, rect)))
+      return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Append 'n' to queue, merging it with queued regions where the result
+ * is the same as applying them in order
+ */
+static void
+region_add(struct region_queue *q, region_t *n)
+{
+  region_t *r, *next;
+
+ again:
+  for(r = TAILQ_FIRST(q); r != NULL; r = next) {
+    next = TAILQ_NEXT(r, r_link);
+    if(r->r_pixfmt != n->r_pixfmt)
+      continue;
+
+    if(rect_contains(n->r_rect, r->r_rect)) {
+      // Completely overwritten
+      TAILQ_REMOVE(q, r, r_link);
+      region_free(r);
+      continue;
+    }
+
+    if(rect_contains(r->r_rect, n->r_rect) &&
+       !region_overlaps_later(r, n->r_rect)) {
+      region_blit(r, n);
+      region_free(n);
+      return;
+    }
+
+    if(region_mergeable(r->r_rect, n->r_rect) &&
+       !region_overlaps_later(r, r->r_rect)) {
+      // The merged region is applied last, so nothing queued after 'r'
+      // may touch what 'r' covers
+      TAILQ_REMOVE(q, r, r_link);
+      region_merge(r, n);
+      region_free(n);
+      n = r;
+      goto again;
+    }
+  }
+  TAILQ_INSERT_TAIL(q, n, r_link);
+}
+
+
+/**
+ * Copy 'sp' with each dimension reduced by 1 << shift. Every byte is a
+ * channel in all formats, so box filtering can be done bytewise: rows
+ * are first summed straight down, which vectorises, then every 1 << shift
+ * texels of that sum are added up
+ */
+static sview_picture_t *
+history_copy(const sview_picture_t *sp, int shift)
+{
+  const int bpp = sview_pixfmt_bpp(sp->pixfmt);
+  const unsigned int n = 1 << shift;
+  const unsigned int width  = MAX(1, sp->width  >> shift);
+  const unsigned int height = MAX(1, sp->height >> shift);
+  sview_picture_t *dst = sview_picture_alloc(width, height, sp->pixfmt, 0);
+  if(dst == NULL)
+    return NULL;
+
+  if(shift == 0) {
+    for(unsigned int y = 0; y < height; y++)
+      memcpy(dst->planes[0] + y * dst->strides[0],
+             sp->planes[0] + y * sp->strides[0], width * bpp);
+    return dst;
+  }
+
+  // Pictures smaller than 1 << shift are averaged over what exists
+  const unsigned int bw = MIN(n, sp->width);
+  const unsigned int bh = MIN(n, sp->height);
+  const size_t row_bytes = (size_t)width * bw * bpp;
+  // At most 256 rows of 255, fits
+  uint16_t *colsum = malloc(row_bytes * sizeof(uint16_t));
+  if(colsum == NULL) {
+    dst->release(dst);
+    return NULL;
+  }
+
+  for(unsigned int y = 0; y < height; y++) {
+    const uint8_t *s = sp->planes[0] + (size_t)y * n * sp->strides[0];
+    for(size_t i = 0; i < row_bytes; i++)
+      colsum[i] = s[i];
+    for(unsigned int j = 1; j < bh; j++) {
+      s += sp->strides[0];
+      for(size_t i = 0; i < row_bytes; i++)
+        colsum[i] += s[i];
+    }
+
+    uint8_t *d = dst->planes[0] + y * dst->strides[0];
+    const uint16_t *c = colsum;
+    for(unsigned int x = 0; x < width; x++, c += bw * bpp) {
+      for(int k = 0; k < bpp; k++) {
+        uint32_t sum = 0;
+        for(unsigned int i = 0; i < bw; i++)
+          sum += c[i * bpp + k];
+        *d++ = sum / (bw * bh);
+      }
+    }
+  }
+  free(colsum);
+  return dst;
+}
+
+
+static history_frame_t *
+history_frame_create(const sview_picture_t *sp, int shift)
+{
+  sview_picture_t *copy = history_copy(sp, shift);
+  if(copy == NULL)
+    return NULL;
+  history_frame_t *hf = calloc(1, sizeof(history_frame_t));
+  hf->hf_picture = copy;
+  hf->hf_width = sp->width;
+  hf->hf_height = sp->height;
+  hf->hf_shift = shift;
+  return hf;
+}
+
+
+static void
+history_frame_destroy(history_frame_t *hf)
+{
+  if(hf == NULL)
+    return;
+  hf->hf_picture->release(hf->hf_picture);
+  free(hf);
+}
+
+
+/**
+ * Shift for the history copy of a picture put in a cell, -1 if the cell
+ * keeps no history or the copy wouldn't fit. The newest setting,
+ * possibly still pending, counts. Called with sv_cell_mutex held
+ */
+static int
+history_shift_locked(sview_t *sv, int col, int row, const sview_picture_t *sp)
+{
+  const img_cell_t *ic, *found = NULL;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(ic->ic_col == col && ic->ic_row == row) {
+      found = ic;
+      break;
+    }
+  }
+  TAILQ_FOREACH(ic, &sv->sv_pending_cells, ic_link) {
+    if(ic->ic_pending & PENDING_HISTORY &&
+       ic->ic_col == col && ic->ic_row == row)
+      found = ic;
+  }
+  if(found == NULL || found->ic_history_frames <= 0)
+    return -1;
+
+  const int shift = found->ic_history_shift;
+  const size_t bytes = (size_t)sview_pixfmt_bpp(sp->pixfmt) *
+    MAX(1, sp->width >> shift) * MAX(1, sp->height >> shift);
+  if(bytes == 0 ||
+     (found->ic_history_bytes && bytes > found->ic_history_bytes))
+    return -1;
+  return shift;
+}
+
+
+/**
+ * Only pending updates that leave something to show may create a cell,
+ * turning things off for a cell that doesn't exist must not grow the
+ * grid
+ */
+static int
+pending_creates_cell(const img_cell_t *p)
+{
+  if(p->ic_pending & PENDING_PICTURE)
+    return 1;
+  if(p->ic_pending & PENDING_COMPARE && p->ic_compare != NULL)
+    return 1;
+  if(p->ic_pending & PENDING_HISTORY && p->ic_history_frames > 0)
+    return 1;
+  if(p->ic_pending & PENDING_COLORMAP &&
+     (p->ic_colormap != SVIEW_COLORMAP_GRAY || p->ic_lut != NULL))
+    return 1;
+  return 0;
+}
+
+
 static void
 copy_pending_cells(sview_t *sv)
 {
@@ -257,17 +827,64 @@ copy_pending_cells(sview_t *sv)
         break;
     }
 
+    if(ic == NULL && !pending_creates_cell(p)) {
+      // Nothing to patch
+      TAILQ_INSERT_TAIL(&flush, p, ic_link);
+      continue;
+    }
+
     if(ic == NULL) {
       ic = calloc(1, sizeof(img_cell_t));
       ic->ic_col = p->ic_col;
       ic->ic_row = p->ic_row;
+      TAILQ_INIT(&ic->ic_regions);
       TAILQ_INSERT_HEAD(&sv->sv_cells, ic, ic_link);
     }
 
-    ic->ic_flags = p->ic_flags;
-    ic->ic_grid_size = p->ic_grid_size;
-    tex_source_swap(&ic->ic_content, &p->ic_content);
-    tex_source_swap(&ic->ic_overlay, &p->ic_overlay);
+    if(p->ic_pending & PENDING_PICTURE) {
+      ic->ic_flags = p->ic_flags;
+      ic->ic_grid_size = p->ic_grid_size;
+      ic->ic_last_update = sv->sv_frame_time;
+      ic->ic_dirty = 1;
+      ic->ic_generation++;
+      ic->ic_compare = NULL;
+      tex_source_swap(&ic->ic_content, &p->ic_content);
+      tex_source_swap(&ic->ic_overlay, &p->ic_overlay);
+      history_frame_t *hf = ic->ic_history_frame;
+      ic->ic_history_frame = p->ic_history_frame;
+      p->ic_history_frame = hf;
+      // Regions queued before this picture are obsolete
+      TAILQ_CONCAT(&p->ic_regions, &ic->ic_regions, r_link);
+    }
+
+    if(p->ic_pending & PENDING_COMPARE) {
+      ic->ic_compare = p->ic_compare;
+      ic->ic_dirty = 1;
+    }
+
+    if(p->ic_pending & PENDING_HISTORY) {
+      ic->ic_history_frames = p->ic_history_frames;
+      ic->ic_history_bytes = p->ic_history_bytes;
+      ic->ic_history_shift = p->ic_history_shift;
+      ic->ic_history_changed = 1;
+    }
+
+    if(p->ic_pending & PENDING_COLORMAP) {
+      ic->ic_colormap = p->ic_colormap;
+      uint8_t *lut = ic->ic_lut;
+      ic->ic_lut = p->ic_lut;
+      p->ic_lut = lut;
+      ic->ic_lut_dirty = 1;
+      ic->ic_dirty = 1;
+    }
+
+    if(p->ic_pending & PENDING_REGIONS) {
+      region_t *r;
+      while((r = TAILQ_FIRST(&p->ic_regions)) != NULL) {
+        TAILQ_REMOVE(&p->ic_regions, r, r_link);
+        region_add(&ic->ic_regions, r);
+      }
+    }
 
     TAILQ_INSERT_TAIL(&flush, p, ic_link);
   }
@@ -278,14 +895,91 @@ copy_pending_cells(sview_t *sv)
     TAILQ_REMOVE(&flush, ic, ic_link);
     tex_source_free(&ic->ic_content);
     tex_source_free(&ic->ic_overlay);
+    region_queue_flush(&ic->ic_regions);
+    history_frame_destroy(ic->ic_history_frame);
+    free(ic->ic_lut);
     free(ic);
   }
 }
 
 
+/**
+ * Set up unpacking of 'sp' into a texture with 'channels' channels and
+ * return the pixels, format and type to pass to glTex[Sub]Image2D().
+ * Formats that are slow to upload are converted into a scratch buffer
+ * first, NULL if there's no memory for it
+ */
+static const void *
+pic_unpack(const sview_picture_t *sp, int channels,
+           GLenum *format, GLenum *type)
+{
+  const int bpp = sview_pixfmt_bpp(sp->pixfmt);
+
+  if(sp->pixfmt == SVIEW_PIXFMT_I && channels == 1) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, sp->strides[0]);
+    *format = GL_RED;
+    *type = GL_UNSIGNED_BYTE;
+    return sp->planes[0];
+  }
+
+  if(convert_needed(sp->pixfmt)) {
+    // Many drivers expand 24 bit and intensity data one pixel at a
+    // time, hand them 32 bit BGRA which is a plain copy instead
+    const int stride = sp->width * 4;
+    uint8_t *buf = convert_scratch((size_t)stride * sp->height);
+    if(buf == NULL)
+      return NULL;
+    convert_to_bgra(sp, buf, stride, CONVERT_SIMD, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    *format = GL_BGRA;
+    *type = GL_UNSIGNED_INT_8_8_8_8_REV;
+    return buf;
+  }
+
+  if(sp->strides[0] % bpp == 0) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, sp->strides[0] / bpp);
+  } else {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  }
+
+  *format = sp->pixfmt == SVIEW_PIXFMT_RGBA ? GL_RGBA : GL_BGRA;
+  *type = GL_UNSIGNED_BYTE;
+  return sp->planes[0];
+}
+
+
+/**
+ * Swizzle for the bound texture, one channel textures sample as R,R,R,R
+ */
+static void
+tex_set_channels(int channels)
+{
+  if(!gl_single_channel)
+    return;
+  const GLint one[4] = {GL_RED, GL_RED, GL_RED, GL_RED};
+  const GLint four[4] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                   channels == 1 ? one : four);
+}
+
+
 static void
 tex_set_pic(tex_t *t, sview_picture_t *sp)
 {
+  if(sview_pixfmt_bpp(sp->pixfmt) == 0)
+    return;
+
+  const int channels =
+    sp->pixfmt == SVIEW_PIXFMT_I && gl_single_channel ? 1 : 4;
+  GLenum format, type;
+  const void *pixels = pic_unpack(sp, channels, &format, &type);
+  if(pixels == NULL)
+    return;
+
   if(t->t_texture == 0) {
     glGenTextures(1, &t->t_texture);
     glBindTexture(GL_TEXTURE_2D, t->t_texture);
@@ -295,31 +989,176 @@ tex_set_pic(tex_t *t, sview_picture_t *sp)
     glBindTexture(GL_TEXTURE_2D, t->t_texture);
   }
 
-  switch(sp->pixfmt) {
-  case SVIEW_PIXFMT_RGBA:
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                 sp->width, sp->height,
-                 0, GL_RGBA, GL_UNSIGNED_BYTE, sp->planes[0]);
-    break;
-  case SVIEW_PIXFMT_BGRA:
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                 sp->width, sp->height,
-                 0, GL_BGRA, GL_UNSIGNED_BYTE, sp->planes[0]);
-    break;
-  case SVIEW_PIXFMT_RGB:
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                 sp->width, sp->height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, sp->planes[0]);
-    break;
-  case SVIEW_PIXFMT_I:
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY,
-                 sp->width, sp->height,
-                 0, GL_RED, GL_UNSIGNED_BYTE, sp->planes[0]);
-    break;
-  }
+  // Texture objects are reused across formats, so always (re)set swizzle
+  tex_set_channels(channels);
+
+  glTexImage2D(GL_TEXTURE_2D, 0, channels == 1 ? GL_R8 : GL_RGBA8,
+               sp->width, sp->height, 0, format, type, pixels);
 
   t->t_width  = sp->width;
   t->t_height = sp->height;
+  t->t_level  = 0;
+  t->t_channels = channels;
+  t->t_pixfmt = sp->pixfmt;
+}
+
+
+static unsigned int
+tex_width(const tex_t *t)
+{
+  return MAX(1, t->t_width >> t->t_level);
+}
+
+static unsigned int
+tex_height(const tex_t *t)
+{
+  return MAX(1, t->t_height >> t->t_level);
+}
+
+
+/**
+ * Box filter the part 'r' (in destination coordinates) of a dw x dh
+ * shrunk copy of sw x sh texels. Both are tightly packed
+ */
+static void
+texels_filter(const uint8_t *src, unsigned int sw, unsigned int sh, int nc,
+              uint8_t *dst, unsigned int dw, unsigned int dh, const rect_t r)
+{
+  for(unsigned int y = r.top; y < r.bottom; y++) {
+    const unsigned int y0 = (uint64_t)y * sh / dh;
+    const unsigned int y1 = MAX(y0 + 1, (uint64_t)(y + 1) * sh / dh);
+    for(unsigned int x = r.left; x < r.right; x++) {
+      const unsigned int x0 = (uint64_t)x * sw / dw;
+      const unsigned int x1 = MAX(x0 + 1, (uint64_t)(x + 1) * sw / dw);
+      uint32_t sum[4] = {};
+      for(unsigned int sy = y0; sy < y1; sy++) {
+        const uint8_t *row = src + ((size_t)sy * sw + x0) * nc;
+        for(unsigned int sx = x0; sx < x1; sx++, row += nc) {
+          for(int c = 0; c < nc; c++)
+            sum[c] += row[c];
+        }
+      }
+      const uint32_t n = (y1 - y0) * (x1 - x0);
+      for(int c = 0; c < nc; c++)
+        dst[((size_t)y * dw + x) * nc + c] = sum[c] / n;
+    }
+  }
+}
+
+
+/**
+ * Copy part 'c' of a region into texels laid out as the texture stores
+ * them, BGRA or a single intensity channel
+ */
+static void
+region_to_texels(const region_t *r, const rect_t c, int nc,
+                 uint8_t *dst, size_t dst_stride)
+{
+  const int bpp = sview_pixfmt_bpp(r->r_pixfmt);
+  const int width = c.right - c.left;
+
+  for(int y = c.top; y < c.bottom; y++) {
+    const uint8_t *s = r->r_data + (y - r->r_rect.top) * r->r_stride +
+      (c.left - r->r_rect.left) * bpp;
+    uint8_t *d = dst + (y - c.top) * dst_stride;
+
+    if(nc == 1 && r->r_pixfmt == SVIEW_PIXFMT_I) {
+      memcpy(d, s, width);
+      continue;
+    }
+
+    for(int x = 0; x < width; x++, s += bpp) {
+      uint8_t bgra[4];
+      switch(r->r_pixfmt) {
+      case SVIEW_PIXFMT_BGRA:
+        memcpy(bgra, s, 4);
+        break;
+      case SVIEW_PIXFMT_RGBA:
+        bgra[0] = s[2]; bgra[1] = s[1]; bgra[2] = s[0]; bgra[3] = s[3];
+        break;
+      case SVIEW_PIXFMT_RGB:
+        bgra[0] = s[2]; bgra[1] = s[1]; bgra[2] = s[0]; bgra[3] = 255;
+        break;
+      default:
+        bgra[0] = bgra[1] = bgra[2] = bgra[3] = s[0];
+        break;
+      }
+      if(nc == 1)
+        *d++ = bgra[2];
+      else {
+        memcpy(d, bgra, 4);
+        d += 4;
+      }
+    }
+  }
+}
+
+
+/**
+ * Patch part of a texture. A shrunk texture (t_level > 0) has the
+ * region written into its full size backing copy and the covered
+ * texels filtered again. Returns the patched area in picture
+ * coordinates
+ */
+static rect_t
+tex_apply_region(tex_t *t, const region_t *r)
+{
+  if(t->t_texture == 0)
+    return (rect_t){0,0,0,0};
+
+  const rect_t c = rect_intersect(r->r_rect,
+                                  (rect_t){0, 0, t->t_width, t->t_height});
+  if(rect_empty(c))
+    return c;
+
+  glBindTexture(GL_TEXTURE_2D, t->t_texture);
+
+  if(t->t_level && t->t_backing != NULL) {
+    const int nc = t->t_channels;
+    const unsigned int dw = tex_width(t);
+    const unsigned int dh = tex_height(t);
+    region_to_texels(r, c, nc,
+                     t->t_backing + ((size_t)c.top * t->t_width + c.left) * nc,
+                     (size_t)t->t_width * nc);
+
+    // Shrunk texels touched by the region
+    const rect_t d = {
+      (uint64_t)c.left * dw / t->t_width,
+      (uint64_t)c.top  * dh / t->t_height,
+      MIN(dw, ((uint64_t)c.right  * dw + t->t_width  - 1) / t->t_width),
+      MIN(dh, ((uint64_t)c.bottom * dh + t->t_height - 1) / t->t_height),
+    };
+    uint8_t *texels = convert_scratch((size_t)dw * dh * nc);
+    if(texels == NULL)
+      return (rect_t){0,0,0,0};
+    texels_filter(t->t_backing, t->t_width, t->t_height, nc,
+                  texels, dw, dh, d);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, dw);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, d.left, d.top,
+                    d.right - d.left, d.bottom - d.top,
+                    nc == 1 ? GL_RED : GL_BGRA, GL_UNSIGNED_BYTE,
+                    texels + ((size_t)d.top * dw + d.left) * nc);
+    return c;
+  }
+
+  const int bpp = sview_pixfmt_bpp(r->r_pixfmt);
+  const sview_picture_t sp = {
+    .width = c.right - c.left,
+    .height = c.bottom - c.top,
+    .pixfmt = r->r_pixfmt,
+    .planes[0] = r->r_data + (c.top - r->r_rect.top) * r->r_stride +
+                 (c.left - r->r_rect.left) * bpp,
+    .strides[0] = r->r_stride,
+  };
+
+  GLenum format, type;
+  const void *pixels = pic_unpack(&sp, t->t_channels, &format, &type);
+  if(pixels == NULL)
+    return (rect_t){0,0,0,0};
+  glTexSubImage2D(GL_TEXTURE_2D, 0, c.left, c.top, sp.width, sp.height,
+                  format, type, pixels);
+  return c;
 }
 
 
@@ -344,21 +1183,642 @@ tex_use_pic(tex_t *t, sview_picture_t *sp)
 
 
 
+
+// 32 bit, or 8 bit for intensity pictures when GL can swizzle
+static size_t
+tex_bytes(const tex_t *t)
+{
+  return t->t_texture ?
+    (size_t)tex_width(t) * tex_height(t) * t->t_channels : 0;
+}
+
+
+static size_t
+tex_bytes_at(const tex_t *t, int level)
+{
+  return (size_t)MAX(1, t->t_width >> level) *
+    MAX(1, t->t_height >> level) * t->t_channels;
+}
+
+
 static void
-upload_textures(sview_t *sv)
+tex_backing_free(sview_t *sv, tex_t *t)
 {
-  img_cell_t *ic;
-  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
-    tex_upload(&ic->ic_content);
-    tex_upload(&ic->ic_overlay);
-  }
+  if(t->t_backing == NULL)
+    return;
+  sv->sv_tex_backing -= tex_bytes_at(t, 0);
+  free(t->t_backing);
+  t->t_backing = NULL;
 }
 
 
+/**
+ * Store texture at picture size >> level. The first time a texture is
+ * shrunk its full size texels are read back and kept in host memory,
+ * all levels are filtered from that copy, and level 0 is restored
+ * from it exactly
+ */
 static void
-tex_draw(const tex_t *t, const rect_t rect, const rgb_t col)
+tex_set_level(sview_t *sv, tex_t *t, int level)
 {
-  if(t->t_texture == 0)
+  const int nc = t->t_channels;
+  const GLenum format = nc == 1 ? GL_RED : GL_BGRA;
+
+  if(level == t->t_level)
+    return;
+
+  glBindTexture(GL_TEXTURE_2D, t->t_texture);
+
+  if(t->t_backing == NULL) {
+    t->t_backing = malloc(tex_bytes_at(t, 0));
+    if(t->t_backing == NULL)
+      return;
+    sv->sv_tex_backing += tex_bytes_at(t, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, t->t_backing);
+  }
+
+  const unsigned int dw = MAX(1, t->t_width  >> level);
+  const unsigned int dh = MAX(1, t->t_height >> level);
+  uint8_t *texels = t->t_backing;
+  if(level > 0) {
+    texels = convert_scratch(tex_bytes_at(t, level));
+    if(texels == NULL)
+      return;
+    texels_filter(t->t_backing, t->t_width, t->t_height, nc,
+                  texels, dw, dh, (rect_t){0, 0, dw, dh});
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, nc == 1 ? GL_R8 : GL_RGBA8, dw, dh,
+               0, format, GL_UNSIGNED_BYTE, texels);
+  t->t_level = level;
+
+  if(level == 0)
+    tex_backing_free(sv, t);
+}
+
+
+/**
+ * Map a rect in picture coordinates to where it was last drawn. One
+ * extra pixel is included for bilinear filtering
+ */
+static rect_t
+cell_picture_to_screen(const img_cell_t *ic, const rect_t r)
+{
+  const rect_t in = ic->ic_inner;
+  const tex_t *t = &ic->ic_content;
+  if(t->t_width == 0 || t->t_height == 0)
+    return (rect_t){0,0,0,0};
+  const int64_t w = in.right - in.left;
+  const int64_t h = in.bottom - in.top;
+  return (rect_t){
+    in.left + r.left   * w / t->t_width  - 1,
+    in.top  + r.top    * h / t->t_height - 1,
+    in.left + (r.right  * w + t->t_width  - 1) / t->t_width  + 1,
+    in.top  + (r.bottom * h + t->t_height - 1) / t->t_height + 1,
+  };
+}
+
+
+static GLuint
+lut_texture_create(void)
+{
+  GLuint t;
+  glGenTextures(1, &t);
+  glBindTexture(GL_TEXTURE_1D, t);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, 256, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  return t;
+}
+
+
+static size_t
+history_frame_bytes(const history_frame_t *hf)
+{
+  const sview_picture_t *sp = hf->hf_picture;
+  return (size_t)sp->strides[0] * sp->height;
+}
+
+
+static void
+history_frame_free(sview_t *sv, history_t *h, history_frame_t *hf)
+{
+  TAILQ_REMOVE(&h->h_frames, hf, hf_link);
+  h->h_count--;
+  h->h_bytes -= history_frame_bytes(hf);
+  sv->sv_history_resident -= history_frame_bytes(hf);
+  sv->sv_history_frames--;
+  hf->hf_picture->release(hf->hf_picture);
+  free(hf);
+}
+
+
+static history_frame_t *
+history_frame_at(history_t *h, int index)
+{
+  history_frame_t *hf;
+  TAILQ_FOREACH(hf, &h->h_frames, hf_link) {
+    if(index-- == 0)
+      return hf;
+  }
+  return NULL;
+}
+
+
+/**
+ * Put the paused frame in h_tex and its position in h_label
+ */
+static void
+history_show(sview_t *sv, img_cell_t *ic)
+{
+  history_t *h = ic->ic_history;
+
+  if(h->h_count == 0)
+    h->h_paused = 0;
+
+  if(!h->h_paused) {
+    if(h->h_tex.t_texture) {
+      sv->sv_tex_resident -= tex_bytes(&h->h_tex) + tex_bytes(&h->h_label);
+      glDeleteTextures(1, &h->h_tex.t_texture);
+      glDeleteTextures(1, &h->h_label.t_texture);
+      memset(&h->h_tex, 0, sizeof(tex_t));
+      memset(&h->h_label, 0, sizeof(tex_t));
+      h->h_shown = 0;
+      ic->ic_dirty = 1;
+    }
+    return;
+  }
+
+  h->h_index = MIN(h->h_index, h->h_count - 1);
+  history_frame_t *hf = history_frame_at(h, h->h_index);
+  if(hf->hf_seq == h->h_shown)
+    return;
+
+  const size_t before = tex_bytes(&h->h_tex) + tex_bytes(&h->h_label);
+  tex_set_pic(&h->h_tex, hf->hf_picture);
+  h->h_tex.t_width  = hf->hf_width;
+  h->h_tex.t_height = hf->hf_height;
+  h->h_tex.t_level  = hf->hf_shift;
+  h->h_shown = hf->hf_seq;
+
+  char label[64];
+  snprintf(label, sizeof(label), "-%d/%d", h->h_index, h->h_count);
+  tex_use_pic(&h->h_label, text_draw_simple(640, 480, 8, label));
+
+  sv->sv_tex_resident += tex_bytes(&h->h_tex) + tex_bytes(&h->h_label) - before;
+  ic->ic_dirty = 1;
+}
+
+
+/**
+ * Drop frames until there's room for 'incoming' more bytes
+ */
+static void
+history_trim(sview_t *sv, img_cell_t *ic, size_t incoming)
+{
+  history_t *h = ic->ic_history;
+  const int max_frames = ic->ic_history_frames - (incoming ? 1 : 0);
+  const size_t max_bytes = ic->ic_history_bytes;
+  history_frame_t *hf;
+
+  while((hf = TAILQ_LAST(&h->h_frames, history_frame_queue)) != NULL) {
+    if(h->h_count <= max_frames &&
+       (max_bytes == 0 || h->h_bytes + incoming <= max_bytes))
+      break;
+    history_frame_free(sv, h, hf);
+  }
+}
+
+
+static void
+history_free(sview_t *sv, img_cell_t *ic)
+{
+  history_t *h = ic->ic_history;
+  history_frame_t *hf;
+  while((hf = TAILQ_FIRST(&h->h_frames)) != NULL)
+    history_frame_free(sv, h, hf);
+  history_show(sv, ic);
+  free(h);
+  ic->ic_history = NULL;
+}
+
+
+static void
+history_configure(sview_t *sv, img_cell_t *ic)
+{
+  ic->ic_history_changed = 0;
+  if(ic->ic_history_frames <= 0) {
+    if(ic->ic_history != NULL)
+      history_free(sv, ic);
+    return;
+  }
+
+  if(ic->ic_history == NULL) {
+    ic->ic_history = calloc(1, sizeof(history_t));
+    TAILQ_INIT(&ic->ic_history->h_frames);
+  }
+  history_trim(sv, ic, 0);
+  history_show(sv, ic);
+}
+
+
+/**
+ * Remember a picture the cell is about to show. The copy normally comes
+ * with the picture, made by the thread that put it; it's only made here
+ * if history was set up or changed after that
+ */
+static void
+history_record(sview_t *sv, img_cell_t *ic, const sview_picture_t *sp)
+{
+  history_t *h = ic->ic_history;
+  history_frame_t *hf = ic->ic_history_frame;
+  ic->ic_history_frame = NULL;
+
+  const int shift = ic->ic_history_shift;
+  if(hf != NULL && hf->hf_shift != shift) {
+    history_frame_destroy(hf);
+    hf = NULL;
+  }
+
+  if(sview_pixfmt_bpp(sp->pixfmt) == 0) {
+    history_frame_destroy(hf);
+    return;
+  }
+
+  const size_t bytes = (size_t)sview_pixfmt_bpp(sp->pixfmt) *
+    MAX(1, sp->width >> shift) * MAX(1, sp->height >> shift);
+  if(ic->ic_history_bytes && bytes > ic->ic_history_bytes) {
+    history_frame_destroy(hf);
+    return;
+  }
+
+  if(hf == NULL && (hf = history_frame_create(sp, shift)) == NULL)
+    return;
+
+  history_trim(sv, ic, bytes);
+
+  hf->hf_seq = ++h->h_seq;
+  TAILQ_INSERT_HEAD(&h->h_frames, hf, hf_link);
+  h->h_count++;
+  h->h_bytes += history_frame_bytes(hf);
+  sv->sv_history_resident += history_frame_bytes(hf);
+  sv->sv_history_frames++;
+
+  // Keep showing the same frame while paused
+  if(h->h_paused)
+    h->h_index++;
+  history_show(sv, ic);
+}
+
+
+/**
+ * Texture to draw for a cell's picture, its history if paused
+ */
+static const tex_t *
+cell_content(const img_cell_t *ic)
+{
+  if(ic->ic_history && ic->ic_history->h_paused)
+    return &ic->ic_history->h_tex;
+  return &ic->ic_content;
+}
+
+
+typedef struct shared_picture {
+  sview_picture_t shp_pic;
+  sview_picture_t *shp_source;
+  int shp_refcount;
+} shared_picture_t;
+
+
+static void
+shared_picture_release(sview_picture_t *sp)
+{
+  shared_picture_t *shp = (shared_picture_t *)sp;
+  if(__atomic_sub_fetch(&shp->shp_refcount, 1, __ATOMIC_ACQ_REL))
+    return;
+  shp->shp_source->release(shp->shp_source);
+  free(shp);
+}
+
+
+static int
+picture_is_shared(const sview_picture_t *sp)
+{
+  return sp->release == shared_picture_release;
+}
+
+
+// Texture memory owned by the cell, shared textures are accounted once
+static size_t
+cell_tex_bytes(const img_cell_t *ic)
+{
+  return (ic->ic_shared ? 0 : tex_bytes(&ic->ic_content)) +
+    tex_bytes(&ic->ic_overlay);
+}
+
+
+static void
+cell_unshare(sview_t *sv, img_cell_t *ic)
+{
+  shared_tex_t *st = ic->ic_shared;
+  if(st == NULL)
+    return;
+
+  ic->ic_shared = NULL;
+  ic->ic_content.t_texture = 0;
+  ic->ic_content.t_width = 0;
+  ic->ic_content.t_height = 0;
+  ic->ic_content.t_level = 0;
+
+  if(--st->st_refs > 0)
+    return;
+
+  sv->sv_tex_resident -= tex_bytes(&st->st_tex);
+  glDeleteTextures(1, &st->st_tex.t_texture);
+  LIST_REMOVE(st, st_link);
+  st->st_picture->release(st->st_picture);
+  free(st);
+}
+
+
+/**
+ * Point the cell at the shared texture of its pending picture, which
+ * is uploaded only if no other cell is showing it already
+ */
+static void
+cell_share(sview_t *sv, img_cell_t *ic)
+{
+  sview_picture_t *sp = ic->ic_content.t_source;
+  ic->ic_content.t_source = NULL;
+
+  shared_tex_t *st;
+  LIST_FOREACH(st, &sv->sv_shared_textures, st_link) {
+    if(st->st_picture == sp)
+      break;
+  }
+
+  if(st == NULL) {
+    st = calloc(1, sizeof(shared_tex_t));
+    st->st_picture = sp;
+    tex_set_pic(&st->st_tex, sp);
+    sv->sv_tex_resident += tex_bytes(&st->st_tex);
+    LIST_INSERT_HEAD(&sv->sv_shared_textures, st, st_link);
+  } else {
+    sp->release(sp);
+  }
+
+  if(ic->ic_content.t_texture) {
+    sv->sv_tex_resident -= tex_bytes(&ic->ic_content);
+    glDeleteTextures(1, &ic->ic_content.t_texture);
+  }
+
+  st->st_refs++;
+  ic->ic_shared = st;
+  ic->ic_content = st->st_tex;
+}
+
+
+static void
+upload_textures(sview_t *sv)
+{
+  img_cell_t *ic;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(ic->ic_history_changed)
+      history_configure(sv, ic);
+
+    sview_picture_t *sp = ic->ic_content.t_source;
+    if(sp != NULL && !ic->ic_shared && ic->ic_content.t_level)
+      sv->sv_tex_restores++;
+    if(sp != NULL)
+      tex_backing_free(sv, &ic->ic_content);
+    if(sp != NULL && ic->ic_history != NULL)
+      history_record(sv, ic, sp);
+    history_frame_destroy(ic->ic_history_frame);
+    ic->ic_history_frame = NULL;
+
+    if(sp != NULL && ic->ic_shared && ic->ic_shared->st_picture == sp) {
+      // Same shared picture again
+      tex_source_free(&ic->ic_content);
+    } else if(sp != NULL) {
+      cell_unshare(sv, ic);
+      if(picture_is_shared(sp))
+        cell_share(sv, ic);
+    }
+
+    const size_t before = cell_tex_bytes(ic);
+
+    tex_upload(&ic->ic_content);
+    tex_upload(&ic->ic_overlay);
+
+    sv->sv_tex_resident += cell_tex_bytes(ic) - before;
+
+    if(ic->ic_shared) {
+      // Other cells use the same texture, it's not ours to patch
+      region_queue_flush(&ic->ic_regions);
+    }
+
+    region_t *r;
+    while((r = TAILQ_FIRST(&ic->ic_regions)) != NULL) {
+      TAILQ_REMOVE(&ic->ic_regions, r, r_link);
+      const rect_t c = tex_apply_region(&ic->ic_content, r);
+      region_free(r);
+      if(rect_empty(c))
+        continue;
+      ic->ic_last_update = sv->sv_frame_time;
+      ic->ic_generation++;
+      damage_add(sv, cell_picture_to_screen(ic, c));
+    }
+
+    if(ic->ic_lut_dirty) {
+      ic->ic_lut_dirty = 0;
+      if(ic->ic_lut == NULL) {
+        glDeleteTextures(1, &ic->ic_lut_texture);
+        ic->ic_lut_texture = 0;
+      } else {
+        if(ic->ic_lut_texture == 0)
+          ic->ic_lut_texture = lut_texture_create();
+        glBindTexture(GL_TEXTURE_1D, ic->ic_lut_texture);
+        glTexSubImage1D(GL_TEXTURE_1D, 0, 0, 256,
+                        GL_RGB, GL_UNSIGNED_BYTE, ic->ic_lut);
+      }
+    }
+  }
+}
+
+
+static int
+cell_lru_cmp(const void *A, const void *B)
+{
+  const img_cell_t *a = *(const img_cell_t **)A;
+  const img_cell_t *b = *(const img_cell_t **)B;
+  // Cells not drawn recently go first, then the least recently updated
+  if(a->ic_last_drawn != b->ic_last_drawn)
+    return a->ic_last_drawn < b->ic_last_drawn ? -1 : 1;
+  if(a->ic_last_update != b->ic_last_update)
+    return a->ic_last_update < b->ic_last_update ? -1 : 1;
+  return 0;
+}
+
+
+/**
+ * Level at which texture is still at least as big as it is on screen
+ */
+static int
+tex_lossless_level(const tex_t *t, int screen_width, int screen_height)
+{
+  int level = 0;
+  while((t->t_width  >> (level + 1)) >= MAX(screen_width, 1) &&
+        (t->t_height >> (level + 1)) >= MAX(screen_height, 1))
+    level++;
+  return level;
+}
+
+
+static int
+tex_proxy_level(const tex_t *t)
+{
+  int level = 0;
+  while(MAX(t->t_width, t->t_height) >> level > TEX_PROXY_MIN_SIZE)
+    level++;
+  return level;
+}
+
+
+static void
+cell_set_level(sview_t *sv, img_cell_t *ic, int level)
+{
+  tex_t *t = &ic->ic_content;
+  level = MIN(level, tex_proxy_level(t));
+  if(level == t->t_level)
+    return;
+  const size_t before = tex_bytes(t);
+  tex_set_level(sv, t, level);
+  sv->sv_tex_resident += tex_bytes(t) - before;
+  damage_add(sv, ic->ic_extent);
+}
+
+
+static int
+cell_recently_drawn(const sview_t *sv, const img_cell_t *ic)
+{
+  return sv->sv_frame_time - ic->ic_last_drawn <= TEX_EVICT_AGE_MS;
+}
+
+
+/**
+ * Give shrunk cells that are on screen their resolution back, most
+ * recently used first, as far as the budget allows. Full size if it
+ * fits, otherwise on-screen size
+ */
+static void
+restore_textures(sview_t *sv, img_cell_t **cells, int n, size_t budget)
+{
+  for(int i = n - 1; i >= 0; i--) {
+    img_cell_t *ic = cells[i];
+    tex_t *t = &ic->ic_content;
+    if(t->t_level == 0 || !cell_recently_drawn(sv, ic))
+      continue;
+
+    const int lossless =
+      tex_lossless_level(t, ic->ic_screen_width, ic->ic_screen_height);
+    const size_t others = sv->sv_tex_resident - tex_bytes(t);
+
+    int level = t->t_level;
+    if(budget == 0 || others + tex_bytes_at(t, 0) <= budget)
+      level = 0;
+    else if(lossless < level && others + tex_bytes_at(t, lossless) <= budget)
+      level = lossless;
+    if(level == t->t_level)
+      continue;
+
+    cell_set_level(sv, ic, level);
+    if(level == 0)
+      sv->sv_tex_restores++;
+  }
+}
+
+
+/**
+ * Keep cell textures within budget. Over budget, cells are shrunk
+ * least recently used first. Cells that haven't been drawn for a while
+ * (window hidden, no room on screen) are shrunk to a small proxy.
+ * Drawn cells are first shrunk to their on-screen size, which is
+ * invisible, and only if that's not enough halved once more per frame.
+ * Shared, overlay and history textures can't be shrunk, so when they
+ * alone exceed the budget visible cells are left alone. Under budget,
+ * shrunk cells are restored from their backing copy
+ */
+static void
+enforce_texture_budget(sview_t *sv)
+{
+  const size_t budget = __atomic_load_n(&sv->sv_tex_budget, __ATOMIC_RELAXED);
+
+  int num_cells = 0;
+  img_cell_t *ic;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link)
+    num_cells++;
+
+  img_cell_t *cells[num_cells];
+  int n = 0;
+  size_t cell_bytes = 0;
+  int shrunk = 0;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    // Shared textures are not tied to any one cell's use, keep them
+    if(ic->ic_content.t_texture && !ic->ic_shared) {
+      cells[n++] = ic;
+      cell_bytes += tex_bytes(&ic->ic_content);
+      shrunk |= ic->ic_content.t_level > 0;
+    }
+  }
+
+  if(budget && sv->sv_tex_resident > budget) {
+    qsort(cells, n, sizeof(cells[0]), cell_lru_cmp);
+    const size_t fixed = sv->sv_tex_resident - cell_bytes;
+
+    for(int pass = 0; pass < 2; pass++) {
+      if(pass == 1 && fixed >= budget)
+        break;
+      for(int i = 0; i < n && sv->sv_tex_resident > budget; i++) {
+        ic = cells[i];
+        tex_t *t = &ic->ic_content;
+        const int prev_level = t->t_level;
+
+        if(!cell_recently_drawn(sv, ic)) {
+          cell_set_level(sv, ic, MAX(t->t_level, tex_proxy_level(t)));
+          if(t->t_level != prev_level)
+            sv->sv_tex_evictions++;
+          continue;
+        }
+
+        const int level = pass == 0 ?
+          tex_lossless_level(t, ic->ic_screen_width, ic->ic_screen_height) :
+          t->t_level + 1;
+        if(level <= t->t_level)
+          continue;
+        cell_set_level(sv, ic, level);
+        if(t->t_level != prev_level)
+          sv->sv_tex_demotions++;
+      }
+    }
+  } else if(shrunk) {
+    qsort(cells, n, sizeof(cells[0]), cell_lru_cmp);
+    restore_textures(sv, cells, n, budget);
+  }
+}
+
+
+static void
+tex_draw(const tex_t *t, const rect_t rect, const rgb_t col)
+{
+  if(t->t_texture == 0)
     return;
 
   glBindTexture(GL_TEXTURE_2D, t->t_texture);
@@ -391,16 +1851,24 @@ crosshair_draw(const rect_t rect, int grid, int flags)
   glVertex3f(rect.right, yc, 0);
 
   if(grid) {
+    // Lines outside the picture would not be covered by cell damage
     for(int i = 1; i <= 10; i++) {
-
-      glVertex3f(xc + i * grid,  rect.top,    0);
-      glVertex3f(xc + i * grid,  rect.bottom, 0);
-      glVertex3f(xc - i * grid,  rect.top,    0);
-      glVertex3f(xc - i * grid,  rect.bottom, 0);
-      glVertex3f(rect.left,  yc + i * grid, 0);
-      glVertex3f(rect.right, yc + i * grid, 0);
-      glVertex3f(rect.left,  yc - i * grid, 0);
-      glVertex3f(rect.right, yc - i * grid, 0);
+      if(xc + i * grid <= rect.right) {
+        glVertex3f(xc + i * grid,  rect.top,    0);
+        glVertex3f(xc + i * grid,  rect.bottom, 0);
+      }
+      if(xc - i * grid >= rect.left) {
+        glVertex3f(xc - i * grid,  rect.top,    0);
+        glVertex3f(xc - i * grid,  rect.bottom, 0);
+      }
+      if(yc + i * grid <= rect.bottom) {
+        glVertex3f(rect.left,  yc + i * grid, 0);
+        glVertex3f(rect.right, yc + i * grid, 0);
+      }
+      if(yc - i * grid >= rect.top) {
+        glVertex3f(rect.left,  yc - i * grid, 0);
+        glVertex3f(rect.right, yc - i * grid, 0);
+      }
     }
   }
 
@@ -409,22 +1877,130 @@ crosshair_draw(const rect_t rect, int grid, int flags)
 }
 
 
+static img_cell_t *
+find_cell(sview_t *sv, int col, int row)
+{
+  img_cell_t *ic;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(ic->ic_col == col && ic->ic_row == row)
+      return ic;
+  }
+  return NULL;
+}
+
+
+static int
+compare_flicker_period(const sview_compare_t *c)
+{
+  return 50 + MAX(c->amount, 0);
+}
+
+
+/**
+ * Resolve the compared cells and mark the compare cell dirty if either
+ * of them or any of the parameters changed
+ */
 static void
-draw_cells(sview_t *sv, const rect_t r0)
+layout_compare(sview_t *sv, img_cell_t *ic)
+{
+  const sview_compare_t *src = ic->ic_compare;
+  const sview_compare_t c = {
+    .a_col = __atomic_load_n(&src->a_col, __ATOMIC_RELAXED),
+    .a_row = __atomic_load_n(&src->a_row, __ATOMIC_RELAXED),
+    .b_col = __atomic_load_n(&src->b_col, __ATOMIC_RELAXED),
+    .b_row = __atomic_load_n(&src->b_row, __ATOMIC_RELAXED),
+    .mode = __atomic_load_n(&src->mode, __ATOMIC_RELAXED),
+    .threshold = __atomic_load_n(&src->threshold, __ATOMIC_RELAXED),
+    .amount = __atomic_load_n(&src->amount, __ATOMIC_RELAXED),
+  };
+
+  if(memcmp(&c, &ic->ic_cmp_state, sizeof(c))) {
+    ic->ic_cmp_state = c;
+    ic->ic_dirty = 1;
+  }
+
+  ic->ic_cmp_a = find_cell(sv, c.a_col, c.a_row);
+  ic->ic_cmp_b = find_cell(sv, c.b_col, c.b_row);
+
+  if(ic->ic_cmp_a && ic->ic_cmp_a->ic_generation != ic->ic_cmp_a_generation) {
+    ic->ic_cmp_a_generation = ic->ic_cmp_a->ic_generation;
+    ic->ic_dirty = 1;
+  }
+  if(ic->ic_cmp_b && ic->ic_cmp_b->ic_generation != ic->ic_cmp_b_generation) {
+    ic->ic_cmp_b_generation = ic->ic_cmp_b->ic_generation;
+    ic->ic_dirty = 1;
+  }
+
+  if(c.mode == SVIEW_COMPARE_FLICKER) {
+    // Redraw at every flip
+    const int period = compare_flicker_period(&c);
+    const int phase = (sv->sv_frame_time / period) & 1;
+    sv->sv_idle_poll_ms =
+      MIN(sv->sv_idle_poll_ms, period - sv->sv_frame_time % period);
+    if(phase != ic->ic_cmp_phase) {
+      ic->ic_cmp_phase = phase;
+      ic->ic_dirty = 1;
+    }
+  }
+}
+
+
+/**
+ * Publish a cell's new viewport and queue the viewport callback, if
+ * any, for the dispatch thread
+ */
+static void
+viewport_update(sview_t *sv, img_cell_t *ic, const sview_viewport_t *vp)
+{
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+  ic->ic_viewport = *vp;
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+
+  pthread_mutex_lock(&sv->sv_dispatch_mutex);
+  if(sv->sv_viewport_cb != NULL && !ic->ic_viewport_queued) {
+    ic->ic_viewport_queued = 1;
+    TAILQ_INSERT_TAIL(&sv->sv_viewport_queue, ic, ic_viewport_link);
+    pthread_cond_signal(&sv->sv_dispatch_cond);
+  }
+  pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+}
+
+
+/**
+ * Position cells on screen and collect damage for cells that changed
+ * or moved since last frame
+ */
+static void
+layout_cells(sview_t *sv, const rect_t r0)
 {
   int num_cols = 1;
   int num_rows = 1;
 
-  const img_cell_t *ic;
+  img_cell_t *ic;
   TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
     num_cols = MAX(num_cols, ic->ic_col + 1);
     num_rows = MAX(num_rows, ic->ic_row + 1);
   }
 
+  if(num_cols != sv->sv_num_cols || num_rows != sv->sv_num_rows) {
+    sv->sv_num_cols = num_cols;
+    sv->sv_num_rows = num_rows;
+    damage_all(sv);
+  }
+
   const int tot_width  = r0.right  - r0.left;
   const int tot_height = r0.bottom - r0.top;
 
+  sv->sv_idle_poll_ms = IDLE_POLL_MS;
+
   TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    const tex_t *content = cell_content(ic);
+    if(ic->ic_compare != NULL) {
+      layout_compare(sv, ic);
+      if(ic->ic_cmp_a != NULL)
+        content = &ic->ic_cmp_a->ic_content;
+    }
+
     const rect_t r = {
       .left   = r0.left + (tot_width  * (ic->ic_col + 0) / num_cols),
       .top    = r0.top  + (tot_height * (ic->ic_row + 0) / num_rows),
@@ -432,151 +2008,946 @@ draw_cells(sview_t *sv, const rect_t r0)
       .bottom = r0.top +  (tot_height * (ic->ic_row + 1) / num_rows),
     };
 
-    const rect_t inner = rect_fit(&ic->ic_content, r);
-    tex_draw(&ic->ic_content, inner, (rgb_t){1,1,1});
+    const rect_t inner = rect_fit(content, r);
+    const rect_t extent =
+      rect_union(r, rect_align(&ic->ic_overlay, rect_inset(inner, 10,10), 7));
+
+    if(ic->ic_dirty || !rect_eq(extent, ic->ic_extent)) {
+      damage_add(sv, ic->ic_extent);
+      damage_add(sv, extent);
+      ic->ic_dirty = 0;
+    }
+
+    ic->ic_rect = r;
+    ic->ic_inner = inner;
+    ic->ic_extent = extent;
+
+    ic->ic_screen_width  = inner.right - inner.left;
+    ic->ic_screen_height = inner.bottom - inner.top;
+
+    const sview_viewport_t vp = {
+      .x = inner.left,
+      .y = inner.top,
+      .width = ic->ic_screen_width,
+      .height = ic->ic_screen_height,
+      .visible = sv->sv_win_visible && !rect_empty(inner),
+    };
+    // Only cells actually seen count as drawn for the texture budget
+    if(vp.visible)
+      ic->ic_last_drawn = sv->sv_frame_time;
+    if(memcmp(&vp, &ic->ic_viewport, sizeof(vp)))
+      viewport_update(sv, ic, &vp);
+  }
+}
+
+
+static const char *compare_fragment_shader =
+  "uniform sampler2D tex_a;\n"
+  "uniform sampler2D tex_b;\n"
+  "uniform int mode;\n"
+  "uniform float threshold;\n"
+  "uniform float amount;\n"
+  "void main() {\n"
+  "  vec2 uv = gl_TexCoord[0].st;\n"
+  "  vec4 a = texture2D(tex_a, uv);\n"
+  "  vec4 b = texture2D(tex_b, uv);\n"
+  "  vec4 c;\n"
+  "  if(mode == 0) {\n"
+  "    vec3 d = abs(a.rgb - b.rgb);\n"
+  "    float m = max(d.r, max(d.g, d.b));\n"
+  "    c = vec4(d * step(threshold, m) * amount, 1.0);\n"
+  "  } else if(mode == 1) {\n"
+  "    c = uv.x < amount ? a : b;\n"
+  "  } else {\n"
+  "    c = mix(a, b, amount);\n"
+  "  }\n"
+  "  gl_FragColor = c * gl_Color;\n"
+  "}\n";
+
+
+static const char *colormap_fragment_shader =
+  "uniform sampler2D tex;\n"
+  "uniform sampler1D lut;\n"
+  "void main() {\n"
+  "  float i = texture2D(tex, gl_TexCoord[0].st).r;\n"
+  "  gl_FragColor = texture1D(lut, i * (255.0 / 256.0) + 0.5 / 256.0) *\n"
+  "    gl_Color;\n"
+  "}\n";
+
+
+/**
+ * Polynomial fits of the matplotlib viridis and inferno colormaps,
+ * c[0] + c[1] * t + ... + c[6] * t^6
+ */
+static const float colormap_viridis[7][3] = {
+  { 0.2777273272234177,  0.005407344544966578, 0.3340998053353061},
+  { 0.1050930431085774,  1.404613529898575,    1.384590162594685},
+  {-0.3308618287255563,  0.214847559468213,    0.09509516302823659},
+  {-4.634230498983486,  -5.799100973351585,  -19.33244095627987},
+  { 6.228269936347081,  14.17993336680509,    56.69055260068105},
+  { 4.776384997670288, -13.74514537774601,   -65.35303263337234},
+  {-5.435455855934631,   4.645852612178535,   26.3124352495832},
+};
+
+static const float colormap_inferno[7][3] = {
+  {  0.0002189403691192265, 0.001651004631001012, -0.01948089843709184},
+  {  0.1065134194856116,    0.5639564367884091,    3.932712388889277},
+  { 11.60249308247187,     -3.972853965665698,   -15.9423941062914},
+  {-41.70399613139459,     17.43639888205313,     44.35414519872813},
+  { 77.162935699427,      -33.40235894210092,    -81.80730925738993},
+  {-71.31942824499214,     32.62606426397723,     73.20951985803202},
+  { 25.13112622477341,    -12.24266895238567,    -23.07032500287172},
+};
+
+
+static uint8_t
+colormap_clamp(float v)
+{
+  return v <= 0 ? 0 : v >= 1 ? 255 : v * 255 + 0.5f;
+}
+
+
+static void
+colormap_fill(sview_colormap_t cm, uint8_t lut[256 * 3])
+{
+  for(int i = 0; i < 256; i++) {
+    const float t = i / 255.0f;
+    uint8_t *o = lut + i * 3;
+    const float (*c)[3] = NULL;
+
+    switch(cm) {
+    case SVIEW_COLORMAP_JET:
+      o[0] = colormap_clamp(1.5f - fabsf(4 * t - 3));
+      o[1] = colormap_clamp(1.5f - fabsf(4 * t - 2));
+      o[2] = colormap_clamp(1.5f - fabsf(4 * t - 1));
+      continue;
+    case SVIEW_COLORMAP_VIRIDIS:
+      c = colormap_viridis;
+      break;
+    case SVIEW_COLORMAP_INFERNO:
+      c = colormap_inferno;
+      break;
+    default:
+      o[0] = o[1] = o[2] = i;
+      continue;
+    }
+
+    for(int j = 0; j < 3; j++) {
+      float v = 0;
+      for(int k = 6; k >= 0; k--)
+        v = v * t + c[k][j];
+      o[j] = colormap_clamp(v);
+    }
+  }
+}
+
+
+static GLuint
+shader_program(const char *name, const char *fragment_src)
+{
+  GLint ok;
+  char log[1024];
+
+  GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fs, 1, &fragment_src, NULL);
+  glCompileShader(fs);
+  glGetShaderiv(fs, GL_COMPILE_STATUS, &ok);
+  if(!ok) {
+    glGetShaderInfoLog(fs, sizeof(log), NULL, log);
+    fprintf(stderr, "sview: Unable to compile %s shader: %s\n", name, log);
+    glDeleteShader(fs);
+    return 0;
+  }
+
+  // No vertex shader, fixed function vertex processing is fine for quads
+  GLuint p = glCreateProgram();
+  glAttachShader(p, fs);
+  glLinkProgram(p);
+  glDeleteShader(fs);
+  glGetProgramiv(p, GL_LINK_STATUS, &ok);
+  if(!ok) {
+    glGetProgramInfoLog(p, sizeof(log), NULL, log);
+    fprintf(stderr, "sview: Unable to link %s shader: %s\n", name, log);
+    glDeleteProgram(p);
+    return 0;
+  }
+  return p;
+}
+
+
+static void
+shaders_init(sview_t *sv)
+{
+  const char *version = (const char *)glGetString(GL_VERSION);
+  if(version == NULL || atoi(version) < 2)
+    return;
+
+  GLuint p = shader_program("compare", compare_fragment_shader);
+  if(p == 0)
+    return;
+  sv->sv_compare_program = p;
+  sv->sv_compare_u_mode      = glGetUniformLocation(p, "mode");
+  sv->sv_compare_u_threshold = glGetUniformLocation(p, "threshold");
+  sv->sv_compare_u_amount    = glGetUniformLocation(p, "amount");
+  glUseProgram(p);
+  glUniform1i(glGetUniformLocation(p, "tex_a"), 0);
+  glUniform1i(glGetUniformLocation(p, "tex_b"), 1);
+
+  p = shader_program("colormap", colormap_fragment_shader);
+  if(p == 0)
+    return;
+  sv->sv_colormap_program = p;
+  glUseProgram(p);
+  glUniform1i(glGetUniformLocation(p, "tex"), 0);
+  glUniform1i(glGetUniformLocation(p, "lut"), 1);
+  glUseProgram(0);
+
+  for(int i = SVIEW_COLORMAP_JET; i <= SVIEW_COLORMAP_INFERNO; i++) {
+    uint8_t lut[256 * 3];
+    colormap_fill(i, lut);
+    sv->sv_colormaps[i] = lut_texture_create();
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, 256, GL_RGB, GL_UNSIGNED_BYTE, lut);
+  }
+}
+
+
+/**
+ * Draw a cell's picture, through its colormap if it has one
+ */
+static void
+content_draw(sview_t *sv, const img_cell_t *ic)
+{
+  const tex_t *t = cell_content(ic);
+  GLuint lut = 0;
+  if(t->t_pixfmt == SVIEW_PIXFMT_I && sv->sv_colormap_program)
+    lut = ic->ic_lut_texture ? ic->ic_lut_texture :
+      sv->sv_colormaps[ic->ic_colormap];
+
+  if(lut == 0 || t->t_texture == 0) {
+    tex_draw(t, ic->ic_inner, (rgb_t){1,1,1});
+    return;
+  }
+
+  glUseProgram(sv->sv_colormap_program);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_1D, lut);
+  glActiveTexture(GL_TEXTURE0);
+  tex_draw(t, ic->ic_inner, (rgb_t){1,1,1});
+  glUseProgram(0);
+}
+
+
+static void
+compare_draw(sview_t *sv, const img_cell_t *ic)
+{
+  const img_cell_t *a = ic->ic_cmp_a;
+  const img_cell_t *b = ic->ic_cmp_b;
+  const sview_compare_t *c = &ic->ic_cmp_state;
+
+  if(a == NULL || b == NULL ||
+     !a->ic_content.t_texture || !b->ic_content.t_texture)
+    return;
+
+  if(sv->sv_compare_program == 0) {
+    // No shader support, show A
+    tex_draw(&a->ic_content, ic->ic_inner, (rgb_t){1,1,1});
+    return;
+  }
+
+  int mode;
+  float amount;
+  switch(c->mode) {
+  case SVIEW_COMPARE_DIFF:
+    mode = 0;
+    amount = 1.0f + c->amount / 100.0f;
+    break;
+  case SVIEW_COMPARE_WIPE:
+    mode = 1;
+    amount = c->amount / 1000.0f;
+    break;
+  case SVIEW_COMPARE_FLICKER:
+    mode = 2;
+    amount = ic->ic_cmp_phase;
+    break;
+  default:
+    mode = 2;
+    amount = c->amount / 1000.0f;
+    break;
+  }
+
+  glUseProgram(sv->sv_compare_program);
+  glUniform1i(sv->sv_compare_u_mode, mode);
+  glUniform1f(sv->sv_compare_u_threshold, c->threshold / 255.0f);
+  glUniform1f(sv->sv_compare_u_amount, amount);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, b->ic_content.t_texture);
+  glActiveTexture(GL_TEXTURE0);
+  tex_draw(&a->ic_content, ic->ic_inner, (rgb_t){1,1,1});
+
+  glUseProgram(0);
+}
+
+
+static void
+draw_cells(sview_t *sv, const rect_t clip)
+{
+  const img_cell_t *ic;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(rect_empty(rect_intersect(ic->ic_extent, clip)))
+      continue;
+
+    const rect_t inner = ic->ic_inner;
+    if(ic->ic_compare != NULL)
+      compare_draw(sv, ic);
+    else
+      content_draw(sv, ic);
     if(ic->ic_flags & SVIEW_PIC_CROSSHAIR)
       crosshair_draw(inner, ic->ic_grid_size, ic->ic_flags);
 
     tex_draw(&ic->ic_overlay, rect_align(&ic->ic_overlay,
                                          rect_inset(inner, 10,10), 7),
              (rgb_t){1,1,1});
+
+    if(ic->ic_history && ic->ic_history->h_paused) {
+      const tex_t *label = &ic->ic_history->h_label;
+      tex_draw(label, rect_align(label, rect_inset(inner, 10,10), 9),
+               (rgb_t){1,1,0});
+    }
   }
 }
 
+#define WIDGET_ROW_HEIGHT 16
+#define WIDGET_SCROLL_ROWS 3
+
 struct widget_state {
 
+  sview_widget_t *ws_widget;
+
+  TAILQ_ENTRY(widget_state) ws_dispatch_link;
+  int ws_dispatch_queued;
+
   tex_t ws_title;
   tex_t ws_value;
 
-  char ws_cur_value_str[32];
+  double ws_cur_value;     // Value shown in ws_value
+  int ws_cur_value_valid;
+
+  rect_t ws_hitbox;        // Empty when scrolled out of view
+  int ws_hover;
+  int ws_grab;
+
+  double ws_grab_value;
+  int ws_grab_x;
+  int ws_grab_y;
+};
+
+
+static int
+widget_enum_count(const sview_widget_t *w)
+{
+  int n = 0;
+  while(w->labels != NULL && w->labels[n] != NULL)
+    n++;
+  return n;
+}
+
+
+static double
+widget_value(const sview_widget_t *w)
+{
+  if(w->type == SVIEW_WIDGET_FLOAT)
+    return sview_widget_get_float(w);
+  return sview_widget_get(w);
+}
+
+
+static void
+widget_value_str(const sview_widget_t *w, double v, char *buf, size_t size)
+{
+  switch(w->type) {
+  case SVIEW_WIDGET_FLOAT:
+    snprintf(buf, size, "%.4g", v);
+    break;
+  case SVIEW_WIDGET_BOOL:
+    snprintf(buf, size, "%s", v ? "on" : "off");
+    break;
+  case SVIEW_WIDGET_ENUM:
+    if(v >= 0 && v < widget_enum_count(w)) {
+      snprintf(buf, size, "%s", w->labels[(int)v]);
+      break;
+    }
+    // FALLTHRU
+  default:
+    snprintf(buf, size, "%d", (int)v);
+    break;
+  }
+}
+
+
+static void
+prep_widgets(sview_t *sv)
+{
+  if(sv->sv_widgets == NULL)
+    return;
+
+  sview_widget_t *w;
+  for(w = sv->sv_widgets; w->name != NULL; w++) {
+    if(w->state == NULL) {
+      w->state = calloc(1, sizeof(struct widget_state));
+      w->state->ws_widget = w;
+      tex_use_pic(&w->state->ws_title, text_draw_simple(640, 480, 8, w->name));
+    }
+    // Titles never change, so the value column can be placed once
+    sv->sv_widget_col1 = MAX(sv->sv_widget_col1,
+                             w->state->ws_title.t_width + 10);
+  }
+  sv->sv_num_widgets = w - sv->sv_widgets;
+}
+
+
+/**
+ * Widgets are laid out in rows of equal height, so finding the one
+ * under the pointer is a division
+ */
+static sview_widget_t *
+widget_at(sview_t *sv, int x, int y)
+{
+  const rect_t r = sv->sv_widget_area;
+  if(x < r.left || x >= r.right || y < r.top || y >= r.bottom)
+    return NULL;
+
+  const int i = sv->sv_widget_first + (y - r.top) / WIDGET_ROW_HEIGHT;
+  if(i >= sv->sv_widget_first + sv->sv_widget_rows || i >= sv->sv_num_widgets)
+    return NULL;
+  return &sv->sv_widgets[i];
+}
+
+
+static void
+layout_widgets(sview_t *sv, const rect_t r0)
+{
+  if(sv->sv_widgets == NULL)
+    return;
+
+  if(!rect_eq(r0, sv->sv_widget_rect)) {
+    damage_add(sv, sv->sv_widget_rect);
+    damage_add(sv, r0);
+    sv->sv_widget_rect = r0;
+  }
+
+  const rect_t r = rect_inset(r0, 5, 5);
+  const int rows = MAX(0, (r.bottom - r.top) / WIDGET_ROW_HEIGHT);
+  const int first = MAX(0, MIN(sv->sv_widget_scroll,
+                               sv->sv_num_widgets - rows));
+  sv->sv_widget_scroll = first;
+
+  if(first != sv->sv_widget_first || rows != sv->sv_widget_rows ||
+     !rect_eq(r, sv->sv_widget_area)) {
+    // Scrolled or resized, forget hitboxes of rows no longer visible
+    const int end = MIN(sv->sv_widget_first + sv->sv_widget_rows,
+                        sv->sv_num_widgets);
+    for(int i = sv->sv_widget_first; i < end; i++)
+      sv->sv_widgets[i].state->ws_hitbox = (rect_t){0,0,0,0};
+    sv->sv_widget_first = first;
+    sv->sv_widget_rows = rows;
+    sv->sv_widget_area = r;
+    damage_add(sv, r0);
+  }
+
+  const int end = MIN(first + rows, sv->sv_num_widgets);
+  for(int i = first; i < end; i++) {
+    sview_widget_t *w = &sv->sv_widgets[i];
+    struct widget_state *ws = w->state;
+
+    const int top = r.top + (i - first) * WIDGET_ROW_HEIGHT;
+    ws->ws_hitbox = (rect_t){r.left, top, r.right, top + WIDGET_ROW_HEIGHT};
+
+    const double v = widget_value(w);
+    if(ws->ws_cur_value_valid && v == ws->ws_cur_value)
+      continue;
+    ws->ws_cur_value = v;
+    ws->ws_cur_value_valid = 1;
+
+    char value_str[64];
+    widget_value_str(w, v, value_str, sizeof(value_str));
+    tex_use_pic(&ws->ws_value, text_draw_simple(640, 480, 8, value_str));
+    damage_add(sv, ws->ws_hitbox);
+  }
+}
+
+
+static void
+draw_widgets(sview_t *sv, const rect_t clip)
+{
+  if(sv->sv_widgets == NULL)
+    return;
+
+  if(rect_empty(rect_intersect(sv->sv_widget_rect, clip)))
+    return;
+
+  const int col1 = sv->sv_widget_col1;
+
+  const rgb_t hover = (rgb_t){1.0, 1.0, 1.0};
+  const rgb_t def   = (rgb_t){0.7, 0.7, 0.7};
+
+  const int end = MIN(sv->sv_widget_first + sv->sv_widget_rows,
+                      sv->sv_num_widgets);
+  for(int i = sv->sv_widget_first; i < end; i++) {
+    struct widget_state *ws = sv->sv_widgets[i].state;
+    if(rect_empty(rect_intersect(ws->ws_hitbox, clip)))
+      continue;
+
+    const rgb_t col = ws->ws_grab || ws->ws_hover ? hover : def;
+
+    tex_draw(&ws->ws_title, rect_align(&ws->ws_title, ws->ws_hitbox, 4), col);
+
+    rect_t rt = rect_align(&ws->ws_value,
+                           rect_pad(ws->ws_hitbox, col1, 0, 0, 0), 4);
+    tex_draw(&ws->ws_value, rt, col);
+  }
+}
+
+
+/**
+ * Queue w->updated() for the dispatch thread. If the widget is already
+ * queued its callback will see the latest value anyway, so intermediate
+ * values during a drag are coalesced
+ */
+static void
+widget_dispatch(sview_t *sv, sview_widget_t *w)
+{
+  struct widget_state *ws = w->state;
+  if(w->updated == NULL)
+    return;
+
+  pthread_mutex_lock(&sv->sv_dispatch_mutex);
+  if(!ws->ws_dispatch_queued) {
+    ws->ws_dispatch_queued = 1;
+    TAILQ_INSERT_TAIL(&sv->sv_dispatch_queue, ws, ws_dispatch_link);
+    pthread_cond_signal(&sv->sv_dispatch_cond);
+  }
+  pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+}
+
+
+static void *
+widget_dispatch_thread(void *aux)
+{
+  sview_t *sv = aux;
+  struct widget_state *ws;
+  img_cell_t *ic;
+
+  pthread_mutex_lock(&sv->sv_dispatch_mutex);
+  while(1) {
+    if((ws = TAILQ_FIRST(&sv->sv_dispatch_queue)) != NULL) {
+      TAILQ_REMOVE(&sv->sv_dispatch_queue, ws, ws_dispatch_link);
+      ws->ws_dispatch_queued = 0;
+      pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+      ws->ws_widget->updated(ws->ws_widget);
+      pthread_mutex_lock(&sv->sv_dispatch_mutex);
+      continue;
+    }
+
+    if((ic = TAILQ_FIRST(&sv->sv_viewport_queue)) != NULL) {
+      // Like widgets, only the latest viewport of a cell is delivered
+      TAILQ_REMOVE(&sv->sv_viewport_queue, ic, ic_viewport_link);
+      ic->ic_viewport_queued = 0;
+      sview_viewport_callback_t *cb = sv->sv_viewport_cb;
+      void *opaque = sv->sv_viewport_opaque;
+      const int col = ic->ic_col;
+      const int row = ic->ic_row;
+      pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+      const sview_viewport_t vp = sview_get_cell_viewport(sv, col, row);
+      if(cb != NULL)
+        cb(sv, col, row, &vp, opaque);
+      pthread_mutex_lock(&sv->sv_dispatch_mutex);
+      continue;
+    }
+
+    pthread_cond_wait(&sv->sv_dispatch_cond, &sv->sv_dispatch_mutex);
+  }
+  return NULL;
+}
+
+
+/**
+ * Start the dispatch thread once something needs it
+ */
+static void
+dispatch_start(sview_t *sv)
+{
+  pthread_mutex_lock(&sv->sv_dispatch_mutex);
+  if(!sv->sv_dispatch_running) {
+    sv->sv_dispatch_running = 1;
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&tid, &attr, widget_dispatch_thread, sv);
+    pthread_attr_destroy(&attr);
+  }
+  pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+}
+
+
+/**
+ * Scrub through the history of the cell under the pointer
+ *
+ *  Left / Right  Step back / forward, stepping past newest resumes
+ *  Home / End    Oldest frame / resume live
+ *  Space         Pause / resume
+ */
+static void
+history_key(sview_t *sv, XKeyEvent *xkey)
+{
+  img_cell_t *ic;
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(xkey->x >= ic->ic_rect.left && xkey->x < ic->ic_rect.right &&
+       xkey->y >= ic->ic_rect.top  && xkey->y < ic->ic_rect.bottom)
+      break;
+  }
+  if(ic == NULL || ic->ic_history == NULL)
+    return;
+
+  history_t *h = ic->ic_history;
+  switch(XLookupKeysym(xkey, 0)) {
+  case XK_Left:
+    h->h_index = h->h_paused ? h->h_index + 1 : 1;
+    h->h_paused = 1;
+    break;
+  case XK_Right:
+    if(h->h_index == 0)
+      h->h_paused = 0;
+    else
+      h->h_index--;
+    break;
+  case XK_Home:
+    h->h_index = h->h_count - 1;
+    h->h_paused = 1;
+    break;
+  case XK_End:
+    h->h_paused = 0;
+    break;
+  case XK_space:
+    h->h_index = 0;
+    h->h_paused = !h->h_paused;
+    break;
+  default:
+    return;
+  }
+  history_show(sv, ic);
+}
+
+
+static void
+widget_set_int(sview_t *sv, sview_widget_t *w, int v)
+{
+  if(v == sview_widget_get(w))
+    return;
+  __atomic_store_n(w->value, v, __ATOMIC_RELEASE);
+  widget_dispatch(sv, w);
+}
+
+
+/**
+ * Click on a widget. Numbers are grabbed for dragging, booleans and
+ * enums change right away (button 3 steps enums backwards)
+ */
+static void
+widget_press(sview_t *sv, sview_widget_t *w, const XButtonEvent *xb)
+{
+  struct widget_state *ws = w->state;
+
+  switch(w->type) {
+  case SVIEW_WIDGET_BOOL:
+    widget_set_int(sv, w, !sview_widget_get(w));
+    return;
+  case SVIEW_WIDGET_ENUM: {
+    const int n = widget_enum_count(w);
+    if(n > 0)
+      widget_set_int(sv, w, (sview_widget_get(w) +
+                             (xb->button == Button3 ? n - 1 : 1)) % n);
+    return;
+  }
+  default:
+    break;
+  }
+
+  ws->ws_grab = 1;
+  ws->ws_grab_x = xb->x;
+  ws->ws_grab_y = xb->y;
+  ws->ws_grab_value = widget_value(w);
+  sv->sv_widget_grab = w;
+  damage_add(sv, ws->ws_hitbox);
+}
+
 
-  rect_t ws_hitbox;
-  int ws_hover;
-  int ws_grab;
+static void
+widget_drag(sview_t *sv, sview_widget_t *w, int x)
+{
+  struct widget_state *ws = w->state;
+  const float delta = x - ws->ws_grab_x;
+
+  if(w->type == SVIEW_WIDGET_FLOAT) {
+    const float range = w->fmax - w->fmin;
+    float v = delta * range / 1000 + ws->ws_grab_value;
+    v = MAX(MIN(w->fmax, v), w->fmin);
+    if(v != sview_widget_get_float(w)) {
+      __atomic_store(w->fvalue, &v, __ATOMIC_RELEASE);
+      widget_dispatch(sv, w);
+    }
+    return;
+  }
 
-  double ws_grab_value;
-  int ws_grab_x;
-  int ws_grab_y;
-};
+  const float range = w->max - w->min;
+  float d = delta * range / 1000;
+  widget_set_int(sv, w, MAX(MIN(w->max, d + ws->ws_grab_value), w->min));
+}
 
 
 static void
-prep_widgets(sview_t *sv)
+widget_event(sview_t *sv, const XEvent *xev)
 {
   if(sv->sv_widgets == NULL)
     return;
 
-  sview_widget_t *w;
-  for(w = sv->sv_widgets; w->name != NULL; w++) {
-    if(w->state == NULL) {
-      w->state = calloc(1, sizeof(struct widget_state));
-      tex_use_pic(&w->state->ws_title, text_draw_simple(640, 480, 8, w->name));
+  sview_widget_t *hit = widget_at(sv, xev->xmotion.x, xev->xmotion.y);
+  sview_widget_t *prev = sv->sv_widget_hover;
+  if(hit != prev) {
+    if(prev != NULL) {
+      prev->state->ws_hover = 0;
+      damage_add(sv, prev->state->ws_hitbox);
+    }
+    if(hit != NULL) {
+      hit->state->ws_hover = 1;
+      damage_add(sv, hit->state->ws_hitbox);
+    }
+    sv->sv_widget_hover = hit;
+  }
+
+  sview_widget_t *grab = sv->sv_widget_grab;
+
+  switch(xev->type) {
+  case ButtonPress:
+    if(xev->xbutton.button == Button4 || xev->xbutton.button == Button5) {
+      const rect_t r = sv->sv_widget_rect;
+      if(xev->xbutton.x >= r.left && xev->xbutton.x < r.right &&
+         xev->xbutton.y >= r.top  && xev->xbutton.y < r.bottom) {
+        // Clamped in layout_widgets()
+        sv->sv_widget_scroll += xev->xbutton.button == Button4 ?
+          -WIDGET_SCROLL_ROWS : WIDGET_SCROLL_ROWS;
+        sv->sv_widget_scroll = MAX(0, sv->sv_widget_scroll);
+        // Rows move under the pointer, hover is picked up on next motion
+        if(hit != NULL) {
+          hit->state->ws_hover = 0;
+          sv->sv_widget_hover = NULL;
+        }
+      }
+      break;
     }
+    if(hit != NULL)
+      widget_press(sv, hit, &xev->xbutton);
+    break;
+
+  case ButtonRelease:
+    if(grab != NULL) {
+      grab->state->ws_grab = 0;
+      damage_add(sv, grab->state->ws_hitbox);
+      sv->sv_widget_grab = NULL;
+    }
+    break;
+
+  case MotionNotify:
+    if(grab != NULL)
+      widget_drag(sv, grab, xev->xmotion.x);
+    break;
   }
 }
 
+static int64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Pick up new pictures and lay out the scene, accumulating damage
+ */
 static void
-draw_widgets(sview_t *sv, const rect_t r0)
+prepare_scene(sview_t *sv)
 {
-  if(sv->sv_widgets == NULL)
-    return;
+  const int win_width  = sv->sv_win_width;
+  const int win_height = sv->sv_win_height;
 
-  sview_widget_t *w;
-  rect_t r = rect_inset(r0, 5, 5);
+  sv->sv_frame_time = monotonic_ms();
 
-  int col1 = 0;
+  copy_pending_cells(sv);
+  upload_textures(sv);
 
-  const rgb_t hover = (rgb_t){1.0, 1.0, 1.0};
-  const rgb_t def   = (rgb_t){0.7, 0.7, 0.7};
+  layout_cells(sv, (const rect_t){0, 0, win_width, win_height});
 
-  for(w = sv->sv_widgets; w->name != NULL; w++) {
-    struct widget_state *ws = w->state;
+  layout_widgets(sv, (const rect_t){win_width * 2 / 3, 0,
+        win_width, win_height});
+}
 
-    const int height = 16;
-    ws->ws_hitbox = (rect_t){r.left, r.top, r.right, r.top + height};
-    r.top += height;
 
-    const rect_t rt = rect_align(&ws->ws_title, ws->ws_hitbox, 4);
-    tex_draw(&ws->ws_title, rt,
-             ws->ws_grab || ws->ws_hover ? hover : def);
-    col1 = MAX(col1, rt.right - rt.left);
-  }
+static void
+draw_scene(sview_t *sv, const rect_t clip)
+{
+  glMatrixMode(GL_PROJECTION);
+  glLoadIdentity();
+  glOrtho(0, sv->sv_win_width, sv->sv_win_height, 0, 0, 1);
 
-  col1 += 10;
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(clip.left, sv->sv_win_height - clip.bottom,
+            clip.right - clip.left, clip.bottom - clip.top);
 
-  for(w = sv->sv_widgets; w->name != NULL; w++) {
-    struct widget_state *ws = w->state;
-    char value_str[32];
-    snprintf(value_str, sizeof(value_str), "%d", *w->value);
-    if(strcmp(ws->ws_cur_value_str, value_str)) {
-      strcpy(ws->ws_cur_value_str, value_str);
-      tex_use_pic(&ws->ws_value, text_draw_simple(640, 480, 8, value_str));
-    }
+  glClearColor(0, 0, 0, 1);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    rect_t rt = rect_align(&w->state->ws_value,
-                           rect_pad(ws->ws_hitbox, col1, 0, 0, 0), 4);
-    tex_draw(&w->state->ws_value, rt,
-             ws->ws_grab || ws->ws_hover ? hover : def);
-  }
+  draw_cells(sv, clip);
+
+  draw_widgets(sv, clip);
+
+  glDisable(GL_SCISSOR_TEST);
 }
 
 
+/**
+ * Redraw damaged parts of the window, if any.
+ *
+ * With GLX_EXT_buffer_age we know how many frames old the back buffer
+ * is and redraw what changed since then. With GLX_MESA_copy_sub_buffer
+ * we never swap, just draw into the back buffer and copy the damaged
+ * area to the front. Otherwise everything is redrawn
+ */
 static void
-widget_event(sview_t *sv, const XEvent *xev)
+present_scene(sview_t *sv, Display *dpy, Window win)
 {
-  sview_widget_t *w;
-  if(sv->sv_widgets == NULL)
+  const rect_t full = {0, 0, sv->sv_win_width, sv->sv_win_height};
+  const rect_t damage = rect_intersect(sv->sv_damage, full);
+  sv->sv_damage = (rect_t){0,0,0,0};
+
+  if(rect_empty(damage))
     return;
 
-  for(w = sv->sv_widgets; w->name != NULL; w++) {
-    struct widget_state *ws = w->state;
-    ws->ws_hover =
-      xev->xmotion.x >= ws->ws_hitbox.left &&
-      xev->xmotion.x <= ws->ws_hitbox.right &&
-      xev->xmotion.y >= ws->ws_hitbox.top &&
-      xev->xmotion.y <= ws->ws_hitbox.bottom;
+  switch(sv->sv_present) {
+  case PRESENT_BUFFER_AGE: {
+    unsigned int age = 0;
+    glXQueryDrawable(dpy, win, GLX_BACK_BUFFER_AGE_EXT, &age);
 
-    if(ws->ws_hover && xev->type == ButtonPress) {
-      ws->ws_grab = 1;
-      ws->ws_grab_x = xev->xmotion.x;
-      ws->ws_grab_y = xev->xmotion.y;
-      ws->ws_grab_value = *w->value;
-    }
-    if(xev->type == ButtonRelease) {
-      ws->ws_grab = 0;
+    rect_t region = damage;
+    if(age == 0 || age > DAMAGE_HISTORY) {
+      region = full;
+    } else {
+      for(int i = 0; i < age - 1; i++)
+        region = rect_union(region, sv->sv_damage_history[i]);
     }
 
+    memmove(sv->sv_damage_history + 1, sv->sv_damage_history,
+            sizeof(rect_t) * (DAMAGE_HISTORY - 1));
+    sv->sv_damage_history[0] = damage;
+
+    draw_scene(sv, region);
+    glXSwapBuffers(dpy, win);
+    break;
+  }
 
-    if(ws->ws_grab && xev->type == MotionNotify) {
-      const float delta = xev->xmotion.x - ws->ws_grab_x;
-      const float range = w->max - w->min;
+  case PRESENT_COPY_SUB_BUFFER:
+    draw_scene(sv, damage);
+    sv->sv_copy_sub_buffer(dpy, win, damage.left,
+                           sv->sv_win_height - damage.bottom,
+                           damage.right - damage.left,
+                           damage.bottom - damage.top);
+    break;
 
-      float d = delta * range / 1000;
-      int v = MAX(MIN(w->max, d + ws->ws_grab_value), w->min);
-      *w->value = v;
-      if(w->updated)
-        w->updated(w);
-    }
+  case PRESENT_SWAP:
+    draw_scene(sv, full);
+    glXSwapBuffers(dpy, win);
+    break;
   }
+}
+
 
+static int
+gl_has_extension(const char *name)
+{
+  const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+  const size_t len = strlen(name);
+  while(ext != NULL && (ext = strstr(ext, name)) != NULL) {
+    if(ext[len] == ' ' || ext[len] == 0)
+      return 1;
+    ext += len;
+  }
+  return 0;
 }
 
+
 static void
-draw_scene(sview_t *sv, int win_width, int win_height)
+gl_caps_init(void)
 {
-  glClearColor(0, 0, 0, 1);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  const char *version = (const char *)glGetString(GL_VERSION);
+  const float v = version ? atof(version) : 0;
+  gl_single_channel = v >= 3.3f ||
+    (gl_has_extension("GL_ARB_texture_rg") &&
+     gl_has_extension("GL_ARB_texture_swizzle"));
+}
 
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  glOrtho(0, win_width, win_height, 0, 0, 1);
 
-  copy_pending_cells(sv);
-  upload_textures(sv);
+static void
+present_init(sview_t *sv, Display *dpy)
+{
+  const char *ext = glXQueryExtensionsString(dpy, DefaultScreen(dpy));
+  if(ext == NULL)
+    return;
+
+  if(strstr(ext, "GLX_EXT_buffer_age")) {
+    sv->sv_present = PRESENT_BUFFER_AGE;
+  } else if(strstr(ext, "GLX_MESA_copy_sub_buffer")) {
+    sv->sv_copy_sub_buffer = (PFNGLXCOPYSUBBUFFERMESAPROC)
+      glXGetProcAddressARB((const GLubyte *)"glXCopySubBufferMESA");
+    if(sv->sv_copy_sub_buffer != NULL)
+      sv->sv_present = PRESENT_COPY_SUB_BUFFER;
+  }
+}
+
+
+/**
+ * Sleep until there are X events, new pictures or it's time to check
+ * widget values again
+ */
+static void
+wait_for_work(sview_t *sv, Display *dpy)
+{
+  if(XPending(dpy))
+    return;
+
+  struct pollfd pfd[2] = {
+    {ConnectionNumber(dpy), POLLIN},
+    {sv->sv_wakeup_fd, POLLIN},
+  };
+  poll(pfd, 2, sv->sv_idle_poll_ms);
+
+  if(pfd[1].revents & POLLIN) {
+    uint64_t v;
+    if(read(sv->sv_wakeup_fd, &v, sizeof(v)) != sizeof(v)) {
+      // Spurious wakeup
+    }
+  }
+}
 
-  draw_cells(sv, (const rect_t){0, 0, win_width, win_height});
 
-  draw_widgets(sv, (const rect_t){win_width * 2 / 3, 0, win_width, win_height});
+static void
+wakeup(sview_t *sv)
+{
+  const uint64_t one = 1;
+  if(write(sv->sv_wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+    // Already pending
+  }
 }
 
 
@@ -602,13 +2973,15 @@ sview_thread(void *aux)
   XSetWindowAttributes swa = {
     .colormap = XCreateColormap(dpy, root, vi->visual, AllocNone),
     .event_mask = ExposureMask | KeyPressMask |
-    ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ButtonMotionMask,
+    ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ButtonMotionMask |
+    StructureNotifyMask | VisibilityChangeMask,
   };
 
-  int win_width  = sv->sv_width;
-  int win_height = sv->sv_height;
+  sv->sv_win_width  = sv->sv_width;
+  sv->sv_win_height = sv->sv_height;
 
-  Window win = XCreateWindow(dpy, root, 0, 0, win_width, win_height,
+  Window win = XCreateWindow(dpy, root, 0, 0,
+                             sv->sv_win_width, sv->sv_win_height,
                              0, vi->depth, InputOutput, vi->visual,
                              CWColormap | CWEventMask, &swa);
   XMapWindow(dpy, win);
@@ -616,6 +2989,9 @@ sview_thread(void *aux)
 
   GLXContext glc = glXCreateContext(dpy, vi, NULL, GL_TRUE);
   glXMakeCurrent(dpy, win, glc);
+  present_init(sv, dpy);
+  gl_caps_init();
+  shaders_init(sv);
 
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   glEnable(GL_BLEND);
@@ -626,6 +3002,7 @@ sview_thread(void *aux)
 
   prep_widgets(sv);
 
+  int64_t scratch_trimmed = 0;
   while(1) {
     XWindowAttributes gwa;
     XEvent xev;
@@ -636,23 +3013,50 @@ sview_thread(void *aux)
       switch(xev.type) {
       case Expose:
         XGetWindowAttributes(dpy, win, &gwa);
-        win_width  = gwa.width;
-        win_height = gwa.height;
-        glViewport(0, 0, win_width, win_height);
+        sv->sv_win_width  = gwa.width;
+        sv->sv_win_height = gwa.height;
+        glViewport(0, 0, sv->sv_win_width, sv->sv_win_height);
+        damage_all(sv);
+        break;
+      case MapNotify:
+        sv->sv_win_visible = 1;
+        break;
+      case UnmapNotify:
+        sv->sv_win_visible = 0;
+        break;
+      case VisibilityNotify:
+        sv->sv_win_visible =
+          xev.xvisibility.state != VisibilityFullyObscured;
         break;
       case KeyPress:
+        history_key(sv, &xev.xkey);
         break;
       case ButtonPress:
       case ButtonRelease:
       case MotionNotify:
+        // Only the latest position matters, skip queued up motion
+        while(xev.type == MotionNotify &&
+              XEventsQueued(dpy, QueuedAfterReading) > 0) {
+          XEvent next;
+          XPeekEvent(dpy, &next);
+          if(next.type != MotionNotify)
+            break;
+          XNextEvent(dpy, &xev);
+        }
         widget_event(sv, &xev);
         break;
       }
     }
 
-    draw_scene(sv, win_width, win_height);
-    glXSwapBuffers(dpy, win);
+    prepare_scene(sv);
+    present_scene(sv, dpy, win);
+    enforce_texture_budget(sv);
 
+    if(sv->sv_frame_time - scratch_trimmed >= SCRATCH_TRIM_MS) {
+      convert_scratch_trim();
+      scratch_trimmed = sv->sv_frame_time;
+    }
+    wait_for_work(sv, dpy);
   }
 
   return NULL;
@@ -671,12 +3075,21 @@ sview_create(const char *title, int width, int height,
   sv->sv_widgets = widgets;
   TAILQ_INIT(&sv->sv_pending_cells);
   TAILQ_INIT(&sv->sv_cells);
+  LIST_INIT(&sv->sv_shared_textures);
+  pthread_mutex_init(&sv->sv_dispatch_mutex, NULL);
+  pthread_cond_init(&sv->sv_dispatch_cond, NULL);
+  TAILQ_INIT(&sv->sv_dispatch_queue);
+  TAILQ_INIT(&sv->sv_viewport_queue);
+  sv->sv_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  sv->sv_idle_poll_ms = IDLE_POLL_MS;
   pthread_t tid;
   pthread_attr_t attr;
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
   pthread_create(&tid, &attr, sview_thread, sv);
   pthread_attr_destroy(&attr);
+  if(widgets != NULL)
+    dispatch_start(sv);
   return sv;
 }
 
@@ -689,6 +3102,8 @@ sview_put_picture(sview_t *sv, int col, int row,
                   const char *text, int flags, int grid_size)
 {
   img_cell_t *ic = calloc(1, sizeof(img_cell_t));
+  ic->ic_pending = PENDING_PICTURE;
+  TAILQ_INIT(&ic->ic_regions);
   ic->ic_content.t_source = picture;
   if(text)
     ic->ic_overlay.t_source = text_draw_simple(640, 480, 8, text);
@@ -698,9 +3113,277 @@ sview_put_picture(sview_t *sv, int col, int row,
   ic->ic_flags = flags;
   ic->ic_grid_size = grid_size;
 
+  // Copy for the cell's history here rather than on the render thread
+  if(picture != NULL) {
+    pthread_mutex_lock(&sv->sv_cell_mutex);
+    const int shift = history_shift_locked(sv, col, row, picture);
+    pthread_mutex_unlock(&sv->sv_cell_mutex);
+    if(shift >= 0)
+      ic->ic_history_frame = history_frame_create(picture, shift);
+  }
+
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+  TAILQ_INSERT_TAIL(&sv->sv_pending_cells, ic, ic_link);
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+  wakeup(sv);
+}
+
+
+int
+sview_pixfmt_bpp(sview_pixfmt_t pixfmt)
+{
+  switch(pixfmt) {
+  case SVIEW_PIXFMT_RGBA:
+  case SVIEW_PIXFMT_BGRA:
+    return 4;
+  case SVIEW_PIXFMT_RGB:
+    return 3;
+  case SVIEW_PIXFMT_I:
+    return 1;
+  }
+  return 0;
+}
+
+
+void
+sview_set_texture_budget(sview_t *sv, size_t bytes)
+{
+  __atomic_store_n(&sv->sv_tex_budget, bytes, __ATOMIC_RELAXED);
+}
+
+
+void
+sview_get_memory_stats(sview_t *sv, sview_memory_stats_t *stats)
+{
+  stats->texture_budget =
+    __atomic_load_n(&sv->sv_tex_budget, __ATOMIC_RELAXED);
+  stats->texture_resident =
+    __atomic_load_n(&sv->sv_tex_resident, __ATOMIC_RELAXED);
+  stats->texture_evictions =
+    __atomic_load_n(&sv->sv_tex_evictions, __ATOMIC_RELAXED);
+  stats->texture_demotions =
+    __atomic_load_n(&sv->sv_tex_demotions, __ATOMIC_RELAXED);
+  stats->texture_restores =
+    __atomic_load_n(&sv->sv_tex_restores, __ATOMIC_RELAXED);
+  stats->texture_backing =
+    __atomic_load_n(&sv->sv_tex_backing, __ATOMIC_RELAXED);
+  stats->history_resident =
+    __atomic_load_n(&sv->sv_history_resident, __ATOMIC_RELAXED);
+  stats->history_frames =
+    __atomic_load_n(&sv->sv_history_frames, __ATOMIC_RELAXED);
+}
+
+
+sview_viewport_t
+sview_get_cell_viewport(sview_t *sv, int col, int row)
+{
+  sview_viewport_t vp = {};
+  img_cell_t *ic;
+
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+  TAILQ_FOREACH(ic, &sv->sv_cells, ic_link) {
+    if(ic->ic_col == col && ic->ic_row == row) {
+      vp = ic->ic_viewport;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+  return vp;
+}
+
+
+void
+sview_set_viewport_callback(sview_t *sv, sview_viewport_callback_t *cb,
+                            void *opaque)
+{
+  pthread_mutex_lock(&sv->sv_dispatch_mutex);
+  sv->sv_viewport_cb = cb;
+  sv->sv_viewport_opaque = opaque;
+  pthread_mutex_unlock(&sv->sv_dispatch_mutex);
+  if(cb != NULL)
+    dispatch_start(sv);
+}
+
+
+void
+sview_set_history(sview_t *sv, int col, int row,
+                  int frames, size_t max_bytes, int shift)
+{
+  img_cell_t *ic = calloc(1, sizeof(img_cell_t));
+  ic->ic_pending = PENDING_HISTORY;
+  TAILQ_INIT(&ic->ic_regions);
+  ic->ic_history_frames = frames;
+  ic->ic_history_bytes = max_bytes;
+  ic->ic_history_shift = MIN(MAX(shift, 0), 8);
+  ic->ic_col = col;
+  ic->ic_row = row;
+
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+  TAILQ_INSERT_TAIL(&sv->sv_pending_cells, ic, ic_link);
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+  wakeup(sv);
+}
+
+
+int
+sview_widget_get(const sview_widget_t *w)
+{
+  return __atomic_load_n(w->value, __ATOMIC_ACQUIRE);
+}
+
+
+float
+sview_widget_get_float(const sview_widget_t *w)
+{
+  float v;
+  __atomic_load(w->fvalue, &v, __ATOMIC_ACQUIRE);
+  return v;
+}
+
+
+void
+sview_update_region(sview_t *sv, int col, int row,
+                    int x, int y, int width, int height,
+                    sview_pixfmt_t pixfmt, const void *data, int stride)
+{
+  if(width <= 0 || height <= 0 || sview_pixfmt_bpp(pixfmt) == 0)
+    return;
+
+  region_t *r = region_create((rect_t){x, y, x + width, y + height},
+                              pixfmt, data, stride);
+
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+
+  // Merge with regions already waiting for this cell, unless a picture
+  // was queued after them
+  img_cell_t *ic;
+  TAILQ_FOREACH_REVERSE(ic, &sv->sv_pending_cells, img_cell_queue, ic_link) {
+    if(ic->ic_col == col && ic->ic_row == row)
+      break;
+  }
+
+  if(ic == NULL || ic->ic_pending & PENDING_PICTURE) {
+    ic = calloc(1, sizeof(img_cell_t));
+    ic->ic_col = col;
+    ic->ic_row = row;
+    TAILQ_INIT(&ic->ic_regions);
+    TAILQ_INSERT_TAIL(&sv->sv_pending_cells, ic, ic_link);
+  }
+  ic->ic_pending |= PENDING_REGIONS;
+  region_add(&ic->ic_regions, r);
+
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+  wakeup(sv);
+}
+
+
+void
+sview_put_compare(sview_t *sv, int col, int row, const sview_compare_t *cmp)
+{
+  img_cell_t *ic = calloc(1, sizeof(img_cell_t));
+  ic->ic_pending = PENDING_COMPARE;
+  TAILQ_INIT(&ic->ic_regions);
+  ic->ic_compare = cmp;
+  ic->ic_col = col;
+  ic->ic_row = row;
+
+  pthread_mutex_lock(&sv->sv_cell_mutex);
+  TAILQ_INSERT_TAIL(&sv->sv_pending_cells, ic, ic_link);
+  pthread_mutex_unlock(&sv->sv_cell_mutex);
+  wakeup(sv);
+}
+
+
+static void
+put_colormap(sview_t *sv, int col, int row, sview_colormap_t cm, uint8_t *lut)
+{
+  img_cell_t *ic = calloc(1, sizeof(img_cell_t));
+  ic->ic_pending = PENDING_COLORMAP;
+  TAILQ_INIT(&ic->ic_regions);
+  ic->ic_colormap = cm;
+  ic->ic_lut = lut;
+  ic->ic_col = col;
+  ic->ic_row = row;
+
   pthread_mutex_lock(&sv->sv_cell_mutex);
   TAILQ_INSERT_TAIL(&sv->sv_pending_cells, ic, ic_link);
   pthread_mutex_unlock(&sv->sv_cell_mutex);
+  wakeup(sv);
+}
+
+
+void
+sview_set_colormap(sview_t *sv, int col, int row, sview_colormap_t cm)
+{
+  if(cm < SVIEW_COLORMAP_GRAY || cm > SVIEW_COLORMAP_INFERNO)
+    cm = SVIEW_COLORMAP_GRAY;
+  put_colormap(sv, col, row, cm, NULL);
+}
+
+
+void
+sview_set_colormap_lut(sview_t *sv, int col, int row,
+                       const uint8_t rgb[256 * 3])
+{
+  uint8_t *lut = malloc(256 * 3);
+  memcpy(lut, rgb, 256 * 3);
+  put_colormap(sv, col, row, SVIEW_COLORMAP_GRAY, lut);
+}
+
+
+static const char *compare_mode_labels[] = {
+  "diff", "wipe", "flicker", "blend", NULL
+};
+
+
+void
+sview_compare_widgets(sview_compare_t *cmp, sview_widget_t *widgets)
+{
+  const sview_widget_t w[SVIEW_COMPARE_NUM_WIDGETS] = {
+    {
+      .name = "Compare",
+      .type = SVIEW_WIDGET_ENUM,
+      .value = &cmp->mode,
+      .labels = compare_mode_labels,
+    }, {
+      .name = "Threshold",
+      .type = SVIEW_WIDGET_INT,
+      .min = 0,
+      .max = 255,
+      .value = &cmp->threshold,
+    }, {
+      .name = "Amount",
+      .type = SVIEW_WIDGET_INT,
+      .min = 0,
+      .max = 1000,
+      .value = &cmp->amount,
+    }
+  };
+  memcpy(widgets, w, sizeof(w));
+}
+
+
+sview_picture_t *
+sview_picture_share(sview_picture_t *sp)
+{
+  shared_picture_t *shp = calloc(1, sizeof(shared_picture_t));
+  shp->shp_pic = *sp;
+  shp->shp_pic.release = shared_picture_release;
+  shp->shp_pic.opaque = NULL;
+  shp->shp_source = sp;
+  shp->shp_refcount = 1;
+  return &shp->shp_pic;
+}
+
+
+sview_picture_t *
+sview_picture_retain(sview_picture_t *sp)
+{
+  if(picture_is_shared(sp)) {
+    shared_picture_t *shp = (shared_picture_t *)sp;
+    __atomic_add_fetch(&shp->shp_refcount, 1, __ATOMIC_RELAXED);
+  }
+  return sp;
 }
 
 
@@ -722,27 +3405,26 @@ sview_picture_alloc(unsigned int width, unsigned int height,
   sp->pixfmt = pixfmt;
   sp->release = sview_picture_default_free;
 
-  int bpp;
-  switch(pixfmt) {
-  case SVIEW_PIXFMT_RGBA:
-  case SVIEW_PIXFMT_BGRA:
-    bpp = 4;
-    break;
-  case SVIEW_PIXFMT_RGB:
-    bpp = 3;
-    break;
-  case SVIEW_PIXFMT_I:
-    bpp = 1;
-    break;
-  default:
+  const int bpp = sview_pixfmt_bpp(pixfmt);
+  if(bpp == 0) {
     free(sp);
     return NULL;
   }
 
   const int align = 4;
-  sp->strides[0] = ((bpp * width) + (align - 1)) & ~(align - 1);
-  const size_t siz = sp->strides[0] * height;
+  const size_t stride = ((size_t)bpp * width + (align - 1)) & ~(align - 1);
+  if(width == 0 || height == 0 || stride > INT_MAX ||
+     height > SIZE_MAX / stride) {
+    free(sp);
+    return NULL;
+  }
+  sp->strides[0] = stride;
+  const size_t siz = stride * height;
   sp->planes[0] = valloc(siz);
+  if(sp->planes[0] == NULL) {
+    free(sp);
+    return NULL;
+  }
   if(clear)
     memset(sp->planes[0], 0, siz);
   return sp;
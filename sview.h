@@ -9,6 +9,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct sview sview_t;
 
@@ -34,10 +35,22 @@ typedef struct sview_picture {
 
 
 typedef enum {
-  SVIEW_WIDGET_INT,
+  SVIEW_WIDGET_INT,    // 'value', dragged between 'min' and 'max'
+  SVIEW_WIDGET_FLOAT,  // 'fvalue', dragged between 'fmin' and 'fmax'
+  SVIEW_WIDGET_BOOL,   // 'value', 0 or 1, toggled by clicking
+  SVIEW_WIDGET_ENUM,   // 'value' indexes 'labels', stepped by clicking
 } sview_widget_type_t;
 
 
+/*
+ * Widget values are written by the display thread while the user drags
+ * them and 'updated' is called from a separate dispatch thread. If the
+ * value changes again while the callback is running, the callback is
+ * called once more with the latest value, intermediate values are
+ * skipped. Read values with sview_widget_get() or
+ * sview_widget_get_float(). The panel scrolls with the mouse wheel when
+ * there are more widgets than fit the window
+ */
 typedef struct sview_widget {
   const char *name;
   sview_widget_type_t type;
@@ -45,9 +58,17 @@ typedef struct sview_widget {
   int *value;
   int max;
   void (*updated)(struct sview_widget *widget);
+  void *opaque;
+  float fmin;
+  float *fvalue;
+  float fmax;
+  const char **labels;        // NULL terminated
   struct widget_state *state; // Internal state
 } sview_widget_t;
 
+int sview_widget_get(const sview_widget_t *w);
+float sview_widget_get_float(const sview_widget_t *w);
+
 // Open a window
 sview_t *sview_create(const char *title, int width, int height,
                       sview_widget_t *widgets);
@@ -56,12 +77,223 @@ void sview_put_picture(sview_t *sv, int col, int row,
                        sview_picture_t *picture,
                        const char *text, int flags, int crosshair_grid_size);
 
+// Patch a rectangle of the picture currently shown in a cell. 'data'
+// is copied. Updates queued for the same cell are merged where possible
+// before upload. Ignored if the cell has no picture yet. A cell shrunk
+// to stay within the texture budget is patched at its reduced size
+void sview_update_region(sview_t *sv, int col, int row,
+                         int x, int y, int width, int height,
+                         sview_pixfmt_t pixfmt, const void *data,
+                         int stride);
+
+/*
+ * Compare two cells on the GPU. The compare cell shows the textures of
+ * cells A and B combined in a shader, so it costs no extra uploads.
+ * The struct is read every frame and must stay valid while shown, its
+ * fields can be changed at any time (for example by widgets)
+ */
+typedef enum {
+  SVIEW_COMPARE_DIFF,     // |A - B|, gain 1 + amount / 100. Pixels whose
+                          // difference is below threshold are black
+  SVIEW_COMPARE_WIPE,     // A left of amount / 1000 of width, B right
+  SVIEW_COMPARE_FLICKER,  // Alternate A and B every 50 + amount ms
+  SVIEW_COMPARE_BLEND,    // A and B mixed, amount / 1000 of B
+} sview_compare_mode_t;
+
+typedef struct sview_compare {
+  int a_col, a_row;
+  int b_col, b_row;
+  int mode;       // sview_compare_mode_t
+  int threshold;  // 0 - 255
+  int amount;     // 0 - 1000, meaning depends on mode
+} sview_compare_t;
+
+// Passing NULL, or a later sview_put_picture() to the same cell, ends
+// the comparison
+void sview_put_compare(sview_t *sv, int col, int row,
+                       const sview_compare_t *cmp);
+
+// Fill in mode / threshold / amount controls for the widget panel
+#define SVIEW_COMPARE_NUM_WIDGETS 3
+void sview_compare_widgets(sview_compare_t *cmp, sview_widget_t *widgets);
+
+/*
+ * Colormaps for SVIEW_PIXFMT_I pictures, applied when drawing so
+ * switching doesn't re-upload anything. The colormap stays with the
+ * cell across sview_put_picture(). Other pixel formats are unaffected
+ */
+typedef enum {
+  SVIEW_COLORMAP_GRAY,
+  SVIEW_COLORMAP_JET,
+  SVIEW_COLORMAP_VIRIDIS,
+  SVIEW_COLORMAP_INFERNO,
+} sview_colormap_t;
+
+void sview_set_colormap(sview_t *sv, int col, int row, sview_colormap_t cm);
+
+// 256 RGB triplets indexed by intensity. The table is copied
+void sview_set_colormap_lut(sview_t *sv, int col, int row,
+                            const uint8_t rgb[256 * 3]);
+
 #define SVIEW_PIC_CROSSHAIR       0x1
 #define SVIEW_PIC_CROSSHAIR_GREEN 0x2
 
 sview_picture_t *sview_picture_alloc(unsigned int width, unsigned int height,
                                      sview_pixfmt_t pixfmt, int clear);
 
+/*
+ * Wrap a picture so it can be put in several cells. Every
+ * sview_put_picture() consumes one reference, take one per cell with
+ * sview_picture_retain(). The pixels are uploaded once into a texture
+ * shared by all cells showing the picture, and 'sp' is released when
+ * the last reference goes. Pixels must not change after sharing, and
+ * sview_update_region() has no effect on cells showing a shared picture
+ */
+sview_picture_t *sview_picture_share(sview_picture_t *sp);
+
+// Take another reference on a picture from sview_picture_share()
+sview_picture_t *sview_picture_retain(sview_picture_t *sp);
+
+/*
+ * Where a cell's picture is on screen, in window pixels. Producers can
+ * use this to render at the size actually shown, or to stop rendering
+ * hidden cells. A cell is not visible when the window is unmapped or
+ * fully covered, or when it has no room. All zero for unknown cells
+ */
+typedef struct sview_viewport {
+  int x, y;
+  int width, height;
+  int visible;
+} sview_viewport_t;
+
+sview_viewport_t sview_get_cell_viewport(sview_t *sv, int col, int row);
+
+/*
+ * Called when a cell's viewport changes, for example when the window is
+ * resized or the grid grows. Runs on the same thread as widget
+ * callbacks, and if the viewport changes again meanwhile only the
+ * latest one is delivered. NULL removes the callback
+ */
+typedef void (sview_viewport_callback_t)(sview_t *sv, int col, int row,
+                                         const sview_viewport_t *vp,
+                                         void *opaque);
+
+void sview_set_viewport_callback(sview_t *sv, sview_viewport_callback_t *cb,
+                                 void *opaque);
+
+/*
+ * Decode a PNG, binary PPM (P6) or PGM (P5) file on a background
+ * thread and show it in a cell, which shows a placeholder until then.
+ * Files requested last are decoded first, and a request is dropped if
+ * another one for the same cell comes in before it was started
+ */
+void sview_put_file(sview_t *sv, int col, int row, const char *path);
+
+// Limit memory used by cell textures. When exceeded, textures of cells
+// that were least recently drawn or updated are shrunk. A shrunk cell
+// is restored to full resolution by its next picture, or as soon as
+// it's on screen and fits in the budget again. 0 means no limit
+void sview_set_texture_budget(sview_t *sv, size_t bytes);
+
+typedef struct sview_memory_stats {
+  size_t texture_budget;
+  size_t texture_resident;          // Bytes of cell textures
+  unsigned int texture_evictions;   // Cells not drawn, shrunk to a proxy
+  unsigned int texture_demotions;   // Drawn cells shrunk
+  unsigned int texture_restores;    // Shrunk cells back at full size
+  size_t texture_backing;           // Host copies kept to restore them
+  size_t history_resident;          // Bytes of frames kept for rewind
+  unsigned int history_frames;
+} sview_memory_stats_t;
+
+void sview_get_memory_stats(sview_t *sv, sview_memory_stats_t *stats);
+
+/*
+ * Keep the last 'frames' pictures shown in a cell, using at most
+ * 'max_bytes' (0 for no limit), stored at picture size >> 'shift'.
+ * With the pointer over the cell, Left / Right steps back and forth,
+ * Home goes to the oldest frame, End returns to live and Space pauses.
+ * The cell keeps receiving pictures while paused. 'frames' == 0 turns
+ * history off. The copies are made by the thread calling
+ * sview_put_picture()
+ */
+void sview_set_history(sview_t *sv, int col, int row,
+                       int frames, size_t max_bytes, int shift);
+
+// Bytes per pixel for pixfmt, or 0 if unknown
+int sview_pixfmt_bpp(sview_pixfmt_t pixfmt);
+
+
+/*
+ * Shared memory transport
+ *
+ * A display process calls sview_shm_serve() to accept producers on a
+ * unix socket. Producers connect with sview_shm_connect() which sets up
+ * a ring of picture slots in a memfd shared with the display process.
+ * Pictures allocated with sview_shm_picture_alloc() live directly in
+ * the ring and are uploaded to texture straight from the mapping.
+ */
+
+int sview_shm_serve(sview_t *sv, const char *path);
+
+typedef struct sview_shm_client sview_shm_client_t;
+
+sview_shm_client_t *sview_shm_connect(const char *path,
+                                      unsigned int num_slots,
+                                      size_t slot_size);
+
+void sview_shm_disconnect(sview_shm_client_t *c);
+
+// Blocks until a slot is available. Returns NULL if the picture does
+// not fit in a slot or if the display process has gone away
+sview_picture_t *sview_shm_picture_alloc(sview_shm_client_t *c,
+                                         unsigned int width,
+                                         unsigned int height,
+                                         sview_pixfmt_t pixfmt, int clear);
+
+// Same semantics as sview_put_picture(). Pictures not allocated from
+// this client's ring are copied into a slot first
+void sview_shm_put_picture(sview_shm_client_t *c, int col, int row,
+                           sview_picture_t *picture,
+                           const char *text, int flags,
+                           int crosshair_grid_size);
+
+
+
+/*
+ * Playback of recorded frame sequences
+ *
+ * Supported files are YUV4MPEG2 (luma is shown), concatenated binary
+ * PGM/PPM and headerless raw frames described by sview_playback_raw_t.
+ * The file is memory mapped and frames are displayed straight from the
+ * mapping, only a small window around the current frame is kept resident
+ */
+
+typedef struct sview_playback sview_playback_t;
+
+typedef struct sview_playback_raw {
+  unsigned int width;
+  unsigned int height;
+  sview_pixfmt_t pixfmt;
+  int stride;  // 0 for tightly packed rows
+} sview_playback_raw_t;
+
+// 'raw' is only used if the file has no recognized header
+sview_playback_t *sview_playback_open(const char *path,
+                                      const sview_playback_raw_t *raw);
+
+unsigned int sview_playback_num_frames(const sview_playback_t *pb);
+
+// Fill in frame / playing / fps controls for the widget panel. Must be
+// called before the widgets are passed to sview_create()
+#define SVIEW_PLAYBACK_NUM_WIDGETS 3
+void sview_playback_widgets(sview_playback_t *pb, sview_widget_t *widgets);
+
+void sview_playback_start(sview_playback_t *pb, sview_t *sv,
+                          int col, int row);
+
+void sview_playback_close(sview_playback_t *pb);
+
 
 #ifdef __cplusplus
 }
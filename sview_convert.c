@@ -0,0 +1,439 @@
+#include <sys/param.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CONVERT_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+#include "sview_convert.h"
+
+// Don't bother waking helper threads for less than this many pixels
+#define CONVERT_PIXELS_PER_THREAD (512 * 1024)
+#define CONVERT_MAX_THREADS 8
+
+typedef void (convert_row_t)(uint8_t *dst, const uint8_t *src,
+                             unsigned int width);
+
+
+/**********************************************************************
+ * Scalar kernels
+ */
+
+static void
+rgb_row_scalar(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  for(unsigned int x = 0; x < width; x++) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = 0xff;
+    dst += 4;
+    src += 3;
+  }
+}
+
+
+static void
+i_row_scalar(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  uint32_t *d = (uint32_t *)dst;
+  for(unsigned int x = 0; x < width; x++)
+    d[x] = src[x] * 0x01010101;
+}
+
+
+
+/**********************************************************************
+ * x86 kernels
+ */
+#ifdef CONVERT_X86
+
+__attribute__((target("ssse3")))
+static void
+rgb_row_ssse3(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                     8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  unsigned int x = 0;
+
+  for(; x + 16 <= width; x += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)(src + 0));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+
+    const __m128i p0 = a;
+    const __m128i p1 = _mm_alignr_epi8(b, a, 12);
+    const __m128i p2 = _mm_alignr_epi8(c, b, 8);
+    const __m128i p3 = _mm_srli_si128(c, 4);
+
+    _mm_storeu_si128((__m128i *)(dst +  0),
+                     _mm_or_si128(_mm_shuffle_epi8(p0, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(dst + 16),
+                     _mm_or_si128(_mm_shuffle_epi8(p1, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(dst + 32),
+                     _mm_or_si128(_mm_shuffle_epi8(p2, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(dst + 48),
+                     _mm_or_si128(_mm_shuffle_epi8(p3, shuf), alpha));
+    src += 48;
+    dst += 64;
+  }
+  rgb_row_scalar(dst, src, width - x);
+}
+
+
+__attribute__((target("avx2")))
+static void
+rgb_row_avx2(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  const __m256i shuf = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                        8, 7, 6, -1, 11, 10, 9, -1,
+                                        2, 1, 0, -1, 5, 4, 3, -1,
+                                        8, 7, 6, -1, 11, 10, 9, -1);
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+  unsigned int x = 0;
+
+  // Each lane takes four pixels from a 16 byte load of which only 12
+  // bytes are used, so keep clear of the last pixels of the row
+  for(; x + 16 + 2 <= width; x += 16) {
+    const __m256i a =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i *)(src +  0))),
+        _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+    const __m256i b =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i *)(src + 24))),
+        _mm_loadu_si128((const __m128i *)(src + 36)), 1);
+
+    _mm256_storeu_si256((__m256i *)(dst +  0),
+                        _mm256_or_si256(_mm256_shuffle_epi8(a, shuf), alpha));
+    _mm256_storeu_si256((__m256i *)(dst + 32),
+                        _mm256_or_si256(_mm256_shuffle_epi8(b, shuf), alpha));
+    src += 48;
+    dst += 64;
+  }
+  rgb_row_scalar(dst, src, width - x);
+}
+
+
+static void
+i_row_sse2(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  unsigned int x = 0;
+
+  for(; x + 16 <= width; x += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)src);
+    const __m128i lo = _mm_unpacklo_epi8(v, v);
+    const __m128i hi = _mm_unpackhi_epi8(v, v);
+    _mm_storeu_si128((__m128i *)(dst +  0), _mm_unpacklo_epi16(lo, lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(lo, lo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(hi, hi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(hi, hi));
+    src += 16;
+    dst += 64;
+  }
+  i_row_scalar(dst, src, width - x);
+}
+
+
+__attribute__((target("avx2")))
+static void
+i_row_avx2(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  const __m256i s0 = _mm256_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1,
+                                      2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5,
+                                      6, 6, 6, 6, 7, 7, 7, 7);
+  const __m256i s1 = _mm256_add_epi8(s0, _mm256_set1_epi8(8));
+  unsigned int x = 0;
+
+  for(; x + 16 <= width; x += 16) {
+    const __m256i v =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)src));
+    _mm256_storeu_si256((__m256i *)(dst +  0), _mm256_shuffle_epi8(v, s0));
+    _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_shuffle_epi8(v, s1));
+    src += 16;
+    dst += 64;
+  }
+  i_row_scalar(dst, src, width - x);
+}
+
+#endif
+
+
+/**********************************************************************
+ * NEON kernels
+ */
+#ifdef CONVERT_NEON
+
+static void
+rgb_row_neon(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  unsigned int x = 0;
+  for(; x + 16 <= width; x += 16) {
+    const uint8x16x3_t rgb = vld3q_u8(src);
+    const uint8x16x4_t bgra = {{rgb.val[2], rgb.val[1], rgb.val[0],
+                                vdupq_n_u8(0xff)}};
+    vst4q_u8(dst, bgra);
+    src += 48;
+    dst += 64;
+  }
+  rgb_row_scalar(dst, src, width - x);
+}
+
+
+static void
+i_row_neon(uint8_t *dst, const uint8_t *src, unsigned int width)
+{
+  unsigned int x = 0;
+  for(; x + 16 <= width; x += 16) {
+    const uint8x16_t v = vld1q_u8(src);
+    const uint8x16x4_t iiii = {{v, v, v, v}};
+    vst4q_u8(dst, iiii);
+    src += 16;
+    dst += 64;
+  }
+  i_row_scalar(dst, src, width - x);
+}
+
+#endif
+
+
+/**********************************************************************
+ * Kernel selection
+ */
+
+static convert_row_t *simd_rgb_row = rgb_row_scalar;
+static convert_row_t *simd_i_row = i_row_scalar;
+static const char *simd_name = "scalar";
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+static void
+simd_init(void)
+{
+#if defined(CONVERT_X86)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    simd_rgb_row = rgb_row_avx2;
+    simd_i_row = i_row_avx2;
+    simd_name = "avx2";
+  } else if(__builtin_cpu_supports("ssse3")) {
+    simd_rgb_row = rgb_row_ssse3;
+    simd_i_row = i_row_sse2;
+    simd_name = "ssse3";
+  } else {
+    simd_i_row = i_row_sse2;
+    simd_name = "sse2";
+  }
+#elif defined(CONVERT_NEON)
+  simd_rgb_row = rgb_row_neon;
+  simd_i_row = i_row_neon;
+  simd_name = "neon";
+#endif
+}
+
+
+const char *
+convert_simd_name(void)
+{
+  pthread_once(&simd_once, simd_init);
+  return simd_name;
+}
+
+
+int
+convert_needed(sview_pixfmt_t pixfmt)
+{
+  return pixfmt == SVIEW_PIXFMT_RGB || pixfmt == SVIEW_PIXFMT_I;
+}
+
+
+/**********************************************************************
+ * Worker pool splitting large pictures into horizontal slices
+ */
+
+typedef struct convert_job {
+  convert_row_t *cj_row;
+  const sview_picture_t *cj_sp;
+  uint8_t *cj_dst;
+  int cj_dst_stride;
+  unsigned int cj_num_slices;
+  unsigned int cj_next_slice;
+  unsigned int cj_done_slices;
+  int cj_active;  // Helper threads currently looking at this job
+} convert_job_t;
+
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t pool_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static convert_job_t *pool_job;
+static unsigned int pool_generation;
+static int pool_threads;
+
+
+static void
+convert_slices(convert_job_t *cj)
+{
+  const sview_picture_t *sp = cj->cj_sp;
+  unsigned int slice;
+  unsigned int done = 0;
+
+  while((slice = __atomic_fetch_add(&cj->cj_next_slice, 1,
+                                    __ATOMIC_RELAXED)) < cj->cj_num_slices) {
+    const unsigned int y0 = sp->height * slice / cj->cj_num_slices;
+    const unsigned int y1 = sp->height * (slice + 1) / cj->cj_num_slices;
+    for(unsigned int y = y0; y < y1; y++)
+      cj->cj_row(cj->cj_dst + y * cj->cj_dst_stride,
+                 sp->planes[0] + y * sp->strides[0], sp->width);
+    done++;
+  }
+
+  pthread_mutex_lock(&pool_mutex);
+  cj->cj_done_slices += done;
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+
+static void *
+convert_thread(void *aux)
+{
+  unsigned int generation = 0;
+
+  pthread_mutex_lock(&pool_mutex);
+  while(1) {
+    convert_job_t *cj = pool_job;
+    if(cj == NULL || generation == pool_generation) {
+      pthread_cond_wait(&pool_work_cond, &pool_mutex);
+      continue;
+    }
+    generation = pool_generation;
+    cj->cj_active++;
+    pthread_mutex_unlock(&pool_mutex);
+    convert_slices(cj);
+    pthread_mutex_lock(&pool_mutex);
+    // Job lives on the submitter's stack, so it must know when we are
+    // done touching it
+    if(--cj->cj_active == 0)
+      pthread_cond_signal(&pool_done_cond);
+  }
+  return NULL;
+}
+
+
+static void
+pool_start(void)
+{
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  pool_threads = MIN(MAX(cpus, 1), CONVERT_MAX_THREADS) - 1;
+
+  pthread_t tid;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for(int i = 0; i < pool_threads; i++)
+    pthread_create(&tid, &attr, convert_thread, NULL);
+  pthread_attr_destroy(&attr);
+}
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+
+void
+convert_to_bgra(const sview_picture_t *sp, uint8_t *dst, int dst_stride,
+                convert_impl_t impl, int threads)
+{
+  pthread_once(&simd_once, simd_init);
+  convert_row_t *row;
+
+  switch(sp->pixfmt) {
+  case SVIEW_PIXFMT_RGB:
+    row = impl == CONVERT_SIMD ? simd_rgb_row : rgb_row_scalar;
+    break;
+  case SVIEW_PIXFMT_I:
+    row = impl == CONVERT_SIMD ? simd_i_row : i_row_scalar;
+    break;
+  default:
+    return;
+  }
+
+  if(threads == 0)
+    threads = (sp->width * sp->height) / CONVERT_PIXELS_PER_THREAD;
+
+  convert_job_t cj = {
+    .cj_row = row,
+    .cj_sp = sp,
+    .cj_dst = dst,
+    .cj_dst_stride = dst_stride,
+  };
+
+  if(threads > 1) {
+    pthread_once(&pool_once, pool_start);
+    threads = MIN(threads, pool_threads + 1);
+  }
+
+  if(threads <= 1) {
+    cj.cj_num_slices = 1;
+    convert_slices(&cj);
+    return;
+  }
+
+  // A few slices per thread evens out threads that start late
+  cj.cj_num_slices = MIN(threads * 4, sp->height);
+
+  pthread_mutex_lock(&pool_job_mutex);
+  pthread_mutex_lock(&pool_mutex);
+  pool_job = &cj;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_work_cond);
+  pthread_mutex_unlock(&pool_mutex);
+
+  convert_slices(&cj);
+
+  pthread_mutex_lock(&pool_mutex);
+  pool_job = NULL;
+  while(cj.cj_done_slices != cj.cj_num_slices || cj.cj_active)
+    pthread_cond_wait(&pool_done_cond, &pool_mutex);
+  pthread_mutex_unlock(&pool_mutex);
+  pthread_mutex_unlock(&pool_job_mutex);
+}
+
+
+static __thread uint8_t *scratch_buf;
+static __thread size_t scratch_size;
+static __thread size_t scratch_used;  // Largest request since last trim
+
+uint8_t *
+convert_scratch(size_t size)
+{
+  scratch_used = MAX(scratch_used, size);
+  if(size > scratch_size) {
+    uint8_t *buf = valloc(size);
+    if(buf == NULL)
+      return NULL;
+    free(scratch_buf);
+    scratch_buf = buf;
+    scratch_size = size;
+  }
+  return scratch_buf;
+}
+
+
+void
+convert_scratch_trim(void)
+{
+  if(scratch_used < scratch_size) {
+    free(scratch_buf);
+    scratch_buf = NULL;
+    scratch_size = 0;
+  }
+  scratch_used = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "sview.h"
+
+/*
+ * Conversion of pixel formats that drivers tend to upload slowly
+ * (SVIEW_PIXFMT_RGB, SVIEW_PIXFMT_I) into 32 bit BGRA which can be
+ * copied straight into a GL_RGBA8 texture.
+ *
+ * SVIEW_PIXFMT_I is expanded to I,I,I,I to match the GL_INTENSITY
+ * texture it used to be uploaded as.
+ */
+
+typedef enum {
+  CONVERT_SCALAR,
+  CONVERT_SIMD,    // Best vector kernel for the running CPU
+} convert_impl_t;
+
+// Returns 1 if pictures of this format should be converted before upload
+int convert_needed(sview_pixfmt_t pixfmt);
+
+// 'threads' == 0 picks a thread count based on picture size
+void convert_to_bgra(const sview_picture_t *sp, uint8_t *dst, int dst_stride,
+                     convert_impl_t impl, int threads);
+
+// Name of the vector kernels selected for this CPU
+const char *convert_simd_name(void);
+
+// Per-thread scratch buffer of at least 'size' bytes, reused across
+// calls. NULL if it can't be allocated
+uint8_t *convert_scratch(size_t size);
+
+// Free the calling thread's scratch buffer unless a request since the
+// last trim needed all of it. Call periodically
+void convert_scratch_trim(void);
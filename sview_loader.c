@@ -0,0 +1,381 @@
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <png.h>
+
+#include "sview.h"
+#include "sview_pnm.h"
+
+/*
+ * Background decoding for sview_put_file(). A small pool of threads
+ * takes requests newest first, so when paging through a large set the
+ * cells the user is looking at now are decoded before the ones they
+ * skipped past. A request that has been superseded by a newer one for
+ * the same cell is dropped without decoding.
+ *
+ * Decoded pictures come from a pool of buffers that released pictures
+ * go back to, so loading many same-sized images doesn't keep hitting
+ * the allocator.
+ */
+
+#define LOADER_MAX_THREADS 4
+#define LOADER_POOL_BYTES (64 * 1024 * 1024)
+
+// Files are untrusted, refuse anything bigger than a texture can be
+#define LOADER_MAX_DIMENSION 16384
+
+// Comments included, PNM headers longer than this are refused
+#define LOADER_PNM_HEADER_MAX 4096
+
+
+typedef struct load_job {
+  TAILQ_ENTRY(load_job) lj_link;
+  struct load_cell *lj_cell;
+  unsigned int lj_seq;
+  char *lj_path;
+} load_job_t;
+
+TAILQ_HEAD(load_job_queue, load_job);
+
+
+/**
+ * Latest request for a cell, used to tell stale jobs. Pictures for the
+ * cell are put holding lc_mutex, so a newer request's picture can't be
+ * overtaken by an older one
+ */
+typedef struct load_cell {
+  LIST_ENTRY(load_cell) lc_link;
+  sview_t *lc_sv;
+  int lc_col;
+  int lc_row;
+  unsigned int lc_seq;   // Written under loader_mutex
+  pthread_mutex_t lc_mutex;
+} load_cell_t;
+
+LIST_HEAD(load_cell_list, load_cell);
+
+
+typedef struct load_buf {
+  sview_picture_t lb_pic;    // Handed out, released back into the pool
+  sview_picture_t *lb_mem;   // From sview_picture_alloc()
+  size_t lb_size;
+  LIST_ENTRY(load_buf) lb_link;
+} load_buf_t;
+
+LIST_HEAD(load_buf_list, load_buf);
+
+
+static pthread_mutex_t loader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loader_cond = PTHREAD_COND_INITIALIZER;
+static struct load_job_queue loader_jobs =
+  TAILQ_HEAD_INITIALIZER(loader_jobs);
+static struct load_cell_list loader_cells;
+static unsigned int loader_seq;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct load_buf_list pool_bufs;
+static size_t pool_bytes;
+
+static sview_picture_t *placeholder;
+
+
+static void
+load_buf_release(sview_picture_t *sp)
+{
+  load_buf_t *lb = (load_buf_t *)sp;
+
+  pthread_mutex_lock(&pool_mutex);
+  if(pool_bytes + lb->lb_size <= LOADER_POOL_BYTES) {
+    pool_bytes += lb->lb_size;
+    LIST_INSERT_HEAD(&pool_bufs, lb, lb_link);
+    lb = NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  if(lb != NULL) {
+    lb->lb_mem->release(lb->lb_mem);
+    free(lb);
+  }
+}
+
+
+static sview_picture_t *
+load_buf_get(unsigned int width, unsigned int height, sview_pixfmt_t pixfmt)
+{
+  load_buf_t *lb;
+
+  pthread_mutex_lock(&pool_mutex);
+  LIST_FOREACH(lb, &pool_bufs, lb_link) {
+    const sview_picture_t *m = lb->lb_mem;
+    if(m->width == width && m->height == height && m->pixfmt == pixfmt) {
+      LIST_REMOVE(lb, lb_link);
+      pool_bytes -= lb->lb_size;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  if(lb == NULL) {
+    sview_picture_t *m = sview_picture_alloc(width, height, pixfmt, 0);
+    if(m == NULL)
+      return NULL;
+    lb = calloc(1, sizeof(load_buf_t));
+    lb->lb_mem = m;
+    lb->lb_size = (size_t)m->strides[0] * m->height;
+  }
+
+  lb->lb_pic = *lb->lb_mem;
+  lb->lb_pic.release = load_buf_release;
+  lb->lb_pic.opaque = NULL;
+  return &lb->lb_pic;
+}
+
+
+static sview_picture_t *
+load_png(const char *path)
+{
+  png_image image = {
+    .version = PNG_IMAGE_VERSION,
+  };
+
+  if(!png_image_begin_read_from_file(&image, path))
+    return NULL;
+
+  if(image.width > LOADER_MAX_DIMENSION ||
+     image.height > LOADER_MAX_DIMENSION) {
+    png_image_free(&image);
+    return NULL;
+  }
+
+  sview_pixfmt_t pixfmt;
+  if(image.format & PNG_FORMAT_FLAG_ALPHA) {
+    image.format = PNG_FORMAT_RGBA;
+    pixfmt = SVIEW_PIXFMT_RGBA;
+  } else if(image.format & PNG_FORMAT_FLAG_COLOR) {
+    image.format = PNG_FORMAT_RGB;
+    pixfmt = SVIEW_PIXFMT_RGB;
+  } else {
+    image.format = PNG_FORMAT_GRAY;
+    pixfmt = SVIEW_PIXFMT_I;
+  }
+
+  sview_picture_t *sp = load_buf_get(image.width, image.height, pixfmt);
+  if(sp == NULL) {
+    png_image_free(&image);
+    return NULL;
+  }
+
+  if(!png_image_finish_read(&image, NULL, sp->planes[0],
+                            sp->strides[0], NULL)) {
+    sp->release(sp);
+    return NULL;
+  }
+  return sp;
+}
+
+
+/**
+ * Binary PGM (P5) and PPM (P6), scaled to 8 bits
+ */
+static sview_picture_t *
+load_pnm(FILE *fp)
+{
+  uint8_t hdr[LOADER_PNM_HEADER_MAX];
+  pnm_header_t h;
+  const size_t len = fread(hdr, 1, sizeof(hdr), fp);
+  const long offset = pnm_header_parse(hdr, len, &h);
+  if(offset < 0 ||
+     h.width > LOADER_MAX_DIMENSION || h.height > LOADER_MAX_DIMENSION ||
+     fseek(fp, offset, SEEK_SET))
+    return NULL;
+
+  sview_picture_t *sp = load_buf_get(h.width, h.height, h.pixfmt);
+  if(sp == NULL)
+    return NULL;
+
+  const size_t samples = (size_t)h.width * sview_pixfmt_bpp(h.pixfmt);
+  const size_t row_bytes = pnm_row_bytes(&h);
+  uint8_t *tmp = h.maxval != 255 ? malloc(row_bytes) : NULL;
+  if(h.maxval != 255 && tmp == NULL)
+    goto bad;
+
+  for(unsigned int y = 0; y < h.height; y++) {
+    uint8_t *dst = sp->planes[0] + (size_t)y * sp->strides[0];
+    if(tmp == NULL) {
+      if(fread(dst, row_bytes, 1, fp) != 1)
+        goto bad;
+      continue;
+    }
+    if(fread(tmp, row_bytes, 1, fp) != 1)
+      goto bad;
+    pnm_row_to_8bit(dst, tmp, samples, h.maxval);
+  }
+  free(tmp);
+  return sp;
+
+ bad:
+  free(tmp);
+  sp->release(sp);
+  return NULL;
+}
+
+
+static sview_picture_t *
+load_file(const char *path)
+{
+  static const uint8_t png_magic[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  uint8_t magic[8] = {};
+
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL)
+    return NULL;
+
+  sview_picture_t *sp = NULL;
+  if(fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+     !memcmp(magic, png_magic, sizeof(magic))) {
+    fclose(fp);
+    return load_png(path);
+  }
+
+  rewind(fp);
+  sp = load_pnm(fp);
+  fclose(fp);
+  return sp;
+}
+
+
+static const char *
+load_name(const char *path)
+{
+  const char *s = strrchr(path, '/');
+  return s ? s + 1 : path;
+}
+
+
+static int
+job_is_stale(const load_job_t *lj)
+{
+  return lj->lj_seq != __atomic_load_n(&lj->lj_cell->lc_seq, __ATOMIC_ACQUIRE);
+}
+
+
+static void *
+loader_thread(void *aux)
+{
+  load_job_t *lj;
+
+  pthread_mutex_lock(&loader_mutex);
+  while(1) {
+    if((lj = TAILQ_FIRST(&loader_jobs)) == NULL) {
+      pthread_cond_wait(&loader_cond, &loader_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&loader_jobs, lj, lj_link);
+
+    if(job_is_stale(lj)) {
+      free(lj->lj_path);
+      free(lj);
+      continue;
+    }
+    pthread_mutex_unlock(&loader_mutex);
+
+    sview_picture_t *sp = load_file(lj->lj_path);
+
+    load_cell_t *lc = lj->lj_cell;
+    const char *name = load_name(lj->lj_path);
+    pthread_mutex_lock(&lc->lc_mutex);
+    if(job_is_stale(lj)) {
+      if(sp != NULL)
+        sp->release(sp);
+    } else if(sp != NULL) {
+      sview_put_picture(lc->lc_sv, lc->lc_col, lc->lc_row, sp, name, 0, 0);
+    } else {
+      char text[512];
+      snprintf(text, sizeof(text), "%s\nUnable to load", name);
+      sview_put_picture(lc->lc_sv, lc->lc_col, lc->lc_row,
+                        sview_picture_retain(placeholder), text, 0, 0);
+    }
+    pthread_mutex_unlock(&lc->lc_mutex);
+
+    free(lj->lj_path);
+    free(lj);
+    pthread_mutex_lock(&loader_mutex);
+  }
+  return NULL;
+}
+
+
+static void
+loader_start(void)
+{
+  // Dark gray 4:3 stand-in while loading, uploaded once per window
+  sview_picture_t *sp = sview_picture_alloc(4, 3, SVIEW_PIXFMT_I, 0);
+  for(int y = 0; y < 3; y++)
+    memset(sp->planes[0] + y * sp->strides[0], 0x30, 4);
+  placeholder = sview_picture_share(sp);
+
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const int threads = MIN(MAX(cpus, 1), LOADER_MAX_THREADS);
+
+  pthread_t tid;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for(int i = 0; i < threads; i++)
+    pthread_create(&tid, &attr, loader_thread, NULL);
+  pthread_attr_destroy(&attr);
+}
+
+static pthread_once_t loader_once = PTHREAD_ONCE_INIT;
+
+
+void
+sview_put_file(sview_t *sv, int col, int row, const char *path)
+{
+  pthread_once(&loader_once, loader_start);
+
+  load_job_t *lj = calloc(1, sizeof(load_job_t));
+  lj->lj_path = strdup(path);
+
+  pthread_mutex_lock(&loader_mutex);
+
+  load_cell_t *lc;
+  LIST_FOREACH(lc, &loader_cells, lc_link) {
+    if(lc->lc_sv == sv && lc->lc_col == col && lc->lc_row == row)
+      break;
+  }
+  if(lc == NULL) {
+    lc = calloc(1, sizeof(load_cell_t));
+    lc->lc_sv = sv;
+    lc->lc_col = col;
+    lc->lc_row = row;
+    pthread_mutex_init(&lc->lc_mutex, NULL);
+    LIST_INSERT_HEAD(&loader_cells, lc, lc_link);
+  }
+  const unsigned int seq = ++loader_seq;
+  __atomic_store_n(&lc->lc_seq, seq, __ATOMIC_RELEASE);
+  lj->lj_seq = seq;
+  lj->lj_cell = lc;
+  pthread_mutex_unlock(&loader_mutex);
+
+  // Placeholder goes in before the job is queued, so it can't land on
+  // top of the decoded picture. Skipped if a newer request got in first
+  char text[512];
+  snprintf(text, sizeof(text), "%s\nLoading", load_name(path));
+  pthread_mutex_lock(&lc->lc_mutex);
+  if(!job_is_stale(lj))
+    sview_put_picture(sv, col, row, sview_picture_retain(placeholder),
+                      text, 0, 0);
+  pthread_mutex_unlock(&lc->lc_mutex);
+
+  // Newest first
+  pthread_mutex_lock(&loader_mutex);
+  TAILQ_INSERT_HEAD(&loader_jobs, lj, lj_link);
+  pthread_cond_signal(&loader_cond);
+  pthread_mutex_unlock(&loader_mutex);
+}
@@ -0,0 +1,538 @@
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sview.h"
+#include "sview_pnm.h"
+
+// Size of resident window ahead of the current frame
+#define READAHEAD_BYTES  (32 * 1024 * 1024)
+#define READAHEAD_FRAMES_MIN 2
+#define READAHEAD_FRAMES_MAX 64
+
+
+struct sview_playback {
+  pthread_mutex_t pb_mutex;
+  pthread_cond_t pb_cond;
+
+  int pb_refcount;
+
+  uint8_t *pb_map;
+  size_t pb_map_size;
+  size_t pb_pagesize;
+
+  unsigned int pb_width;
+  unsigned int pb_height;
+  sview_pixfmt_t pb_pixfmt;
+  unsigned int pb_maxval;  // PNM samples other than 0 - 255 are scaled
+  int pb_stride;
+  size_t pb_frame_size;
+
+  uint64_t *pb_offsets;
+  unsigned int pb_num_frames;
+
+  sview_t *pb_sv;
+  int pb_col;
+  int pb_row;
+
+  // Controls, also pointed to by the widgets
+  int pb_frame;
+  int pb_playing;
+  int pb_fps;
+
+  int pb_seek;
+  int pb_running;
+  int pb_closing;
+
+  // Read-ahead window [pb_ra_start, pb_ra_end) currently advised
+  unsigned int pb_ra_pos;
+  int pb_ra_pending;
+  unsigned int pb_ra_start;
+  unsigned int pb_ra_end;
+
+  pthread_t pb_play_tid;
+  pthread_t pb_ra_tid;
+};
+
+
+typedef struct playback_picture {
+  sview_picture_t sp;
+  sview_playback_t *pb;
+} playback_picture_t;
+
+
+static void
+playback_release(sview_playback_t *pb)
+{
+  if(__atomic_sub_fetch(&pb->pb_refcount, 1, __ATOMIC_ACQ_REL))
+    return;
+  munmap(pb->pb_map, pb->pb_map_size);
+  pthread_cond_destroy(&pb->pb_cond);
+  pthread_mutex_destroy(&pb->pb_mutex);
+  free(pb->pb_offsets);
+  free(pb);
+}
+
+
+static void
+playback_picture_release(sview_picture_t *sp)
+{
+  // Pixels belong to the mapping, nothing to free but the wrapper
+  playback_picture_t *pp = (playback_picture_t *)sp;
+  sview_playback_t *pb = pp->pb;
+  free(pp);
+  playback_release(pb);
+}
+
+
+static void
+playback_add_frame(sview_playback_t *pb, uint64_t offset,
+                   unsigned int *capacity)
+{
+  if(pb->pb_num_frames == *capacity) {
+    *capacity = MAX(64, *capacity * 2);
+    pb->pb_offsets = realloc(pb->pb_offsets,
+                             *capacity * sizeof(pb->pb_offsets[0]));
+  }
+  pb->pb_offsets[pb->pb_num_frames++] = offset;
+}
+
+
+static int
+pnm_index(sview_playback_t *pb)
+{
+  const uint8_t *p = pb->pb_map;
+  const size_t len = pb->pb_map_size;
+  unsigned int capacity = 0;
+  size_t pos = 0;
+  pnm_header_t h;
+  long offset;
+
+  while((offset = pnm_header_parse(p + pos, len - pos, &h)) >= 0) {
+    pos += offset;
+    // 16 bit frames would need converting on every show
+    if(h.maxval > 255)
+      break;
+
+    if(pb->pb_num_frames == 0) {
+      pb->pb_width = h.width;
+      pb->pb_height = h.height;
+      pb->pb_pixfmt = h.pixfmt;
+      pb->pb_maxval = h.maxval;
+      pb->pb_stride = h.width * sview_pixfmt_bpp(h.pixfmt);
+      pb->pb_frame_size = (size_t)pb->pb_stride * h.height;
+    } else if(h.width != pb->pb_width || h.height != pb->pb_height ||
+              h.pixfmt != pb->pb_pixfmt || h.maxval != pb->pb_maxval) {
+      break;
+    }
+
+    if(pos + pb->pb_frame_size > len)
+      break;
+    playback_add_frame(pb, pos, &capacity);
+    pos += pb->pb_frame_size;
+  }
+  return pb->pb_num_frames ? 0 : -1;
+}
+
+
+static int
+y4m_index(sview_playback_t *pb)
+{
+  const uint8_t *p = pb->pb_map;
+  const size_t len = pb->pb_map_size;
+  unsigned int capacity = 0;
+  unsigned int width = 0, height = 0;
+  unsigned int fps_num = 0, fps_den = 0;
+  char colorspace[32] = "420";
+
+  const uint8_t *eol = memchr(p, '\n', MIN(len, 1024));
+  if(eol == NULL)
+    return -1;
+
+  char hdr[1024];
+  memcpy(hdr, p, eol - p);
+  hdr[eol - p] = 0;
+
+  char *saveptr;
+  for(char *tok = strtok_r(hdr, " ", &saveptr); tok != NULL;
+      tok = strtok_r(NULL, " ", &saveptr)) {
+    switch(tok[0]) {
+    case 'W':
+      width = atoi(tok + 1);
+      break;
+    case 'H':
+      height = atoi(tok + 1);
+      break;
+    case 'F':
+      sscanf(tok + 1, "%u:%u", &fps_num, &fps_den);
+      break;
+    case 'C':
+      snprintf(colorspace, sizeof(colorspace), "%s", tok + 1);
+      break;
+    }
+  }
+
+  if(width == 0 || height == 0 || width > 65536 || height > 65536)
+    return -1;
+
+  const size_t luma = (size_t)width * height;
+  const size_t cw = (width + 1) / 2;
+  const size_t ch = (height + 1) / 2;
+  size_t frame_size;
+
+  if(!strncmp(colorspace, "mono", 4))
+    frame_size = luma;
+  else if(!strncmp(colorspace, "444alpha", 8))
+    frame_size = luma * 4;
+  else if(!strncmp(colorspace, "444", 3))
+    frame_size = luma * 3;
+  else if(!strncmp(colorspace, "422", 3))
+    frame_size = luma + 2 * cw * height;
+  else if(!strncmp(colorspace, "420", 3))
+    frame_size = luma + 2 * cw * ch;
+  else
+    return -1;
+
+  // Only the luma plane is displayed, the chroma planes are never touched
+  pb->pb_width = width;
+  pb->pb_height = height;
+  pb->pb_pixfmt = SVIEW_PIXFMT_I;
+  pb->pb_stride = width;
+  pb->pb_frame_size = frame_size;
+
+  if(fps_num && fps_den)
+    pb->pb_fps = MAX(1, (fps_num + fps_den / 2) / fps_den);
+
+  size_t pos = eol - p + 1;
+  while(pos + 5 < len && !memcmp(p + pos, "FRAME", 5)) {
+    eol = memchr(p + pos, '\n', MIN(len - pos, 1024));
+    if(eol == NULL)
+      break;
+    pos = eol - p + 1;
+    if(pos + frame_size > len)
+      break;
+    playback_add_frame(pb, pos, &capacity);
+    pos += frame_size;
+  }
+  return pb->pb_num_frames ? 0 : -1;
+}
+
+
+static int
+raw_index(sview_playback_t *pb, const sview_playback_raw_t *raw)
+{
+  const int bpp = sview_pixfmt_bpp(raw->pixfmt);
+  if(bpp == 0 || raw->width == 0 || raw->height == 0)
+    return -1;
+
+  pb->pb_width = raw->width;
+  pb->pb_height = raw->height;
+  pb->pb_pixfmt = raw->pixfmt;
+  pb->pb_stride = raw->stride ?: raw->width * bpp;
+  if(pb->pb_stride < raw->width * bpp ||
+     (pb->pb_stride % bpp && pb->pb_stride != ((raw->width * bpp + 3) & ~3)))
+    return -1;
+  pb->pb_frame_size = (size_t)pb->pb_stride * raw->height;
+
+  unsigned int capacity = 0;
+  for(size_t pos = 0; pos + pb->pb_frame_size <= pb->pb_map_size;
+      pos += pb->pb_frame_size)
+    playback_add_frame(pb, pos, &capacity);
+  return pb->pb_num_frames ? 0 : -1;
+}
+
+
+static void
+playback_advise(sview_playback_t *pb, unsigned int first, unsigned int last,
+                int advice)
+{
+  if(first >= last)
+    return;
+  const size_t mask = pb->pb_pagesize - 1;
+  const size_t start = pb->pb_offsets[first] & ~mask;
+  const size_t end = MIN(pb->pb_offsets[last - 1] + pb->pb_frame_size,
+                         pb->pb_map_size);
+  madvise(pb->pb_map + start, end - start, advice);
+}
+
+
+static void *
+playback_readahead_thread(void *aux)
+{
+  sview_playback_t *pb = aux;
+  const unsigned int ahead =
+    MIN(MAX(READAHEAD_BYTES / pb->pb_frame_size, READAHEAD_FRAMES_MIN),
+        READAHEAD_FRAMES_MAX);
+
+  pthread_mutex_lock(&pb->pb_mutex);
+  while(!pb->pb_closing) {
+
+    if(!pb->pb_ra_pending) {
+      pthread_cond_wait(&pb->pb_cond, &pb->pb_mutex);
+      continue;
+    }
+    pb->pb_ra_pending = 0;
+    const unsigned int pos = pb->pb_ra_pos;
+    const unsigned int start = pos;
+    const unsigned int end = MIN(pos + ahead, pb->pb_num_frames);
+    const unsigned int old_start = pb->pb_ra_start;
+    const unsigned int old_end = pb->pb_ra_end;
+    pb->pb_ra_start = start;
+    pb->pb_ra_end = end;
+    pthread_mutex_unlock(&pb->pb_mutex);
+
+    /*
+     * Drop whatever fell out of the window so RSS stays constant no
+     * matter how long the recording is. Adjacent frames share edge
+     * pages, so keep one frame of slack around the new window
+     */
+    if(old_end > old_start) {
+      playback_advise(pb, old_start, MIN(old_end, start ? start - 1 : 0),
+                      MADV_DONTNEED);
+      playback_advise(pb, MAX(old_start, end + 1), old_end, MADV_DONTNEED);
+    }
+    playback_advise(pb, start, end, MADV_WILLNEED);
+
+    pthread_mutex_lock(&pb->pb_mutex);
+  }
+  pthread_mutex_unlock(&pb->pb_mutex);
+  return NULL;
+}
+
+
+static void
+playback_show(sview_playback_t *pb, unsigned int frame)
+{
+  char text[32];
+  snprintf(text, sizeof(text), "%u / %u", frame, pb->pb_num_frames);
+
+  if(pb->pb_maxval && pb->pb_maxval != 255) {
+    // Not 8 bit full range, scale a copy instead of showing the mapping
+    sview_picture_t *sp = sview_picture_alloc(pb->pb_width, pb->pb_height,
+                                              pb->pb_pixfmt, 0);
+    if(sp == NULL)
+      return;
+    const uint8_t *src = pb->pb_map + pb->pb_offsets[frame];
+    for(unsigned int y = 0; y < pb->pb_height; y++)
+      pnm_row_to_8bit(sp->planes[0] + (size_t)y * sp->strides[0],
+                      src + (size_t)y * pb->pb_stride, pb->pb_stride,
+                      pb->pb_maxval);
+    sview_put_picture(pb->pb_sv, pb->pb_col, pb->pb_row, sp, text, 0, 0);
+    return;
+  }
+
+  playback_picture_t *pp = calloc(1, sizeof(playback_picture_t));
+  pp->sp.width = pb->pb_width;
+  pp->sp.height = pb->pb_height;
+  pp->sp.pixfmt = pb->pb_pixfmt;
+  pp->sp.planes[0] = pb->pb_map + pb->pb_offsets[frame];
+  pp->sp.strides[0] = pb->pb_stride;
+  pp->sp.release = playback_picture_release;
+  pp->pb = pb;
+  __atomic_add_fetch(&pb->pb_refcount, 1, __ATOMIC_ACQ_REL);
+
+  sview_put_picture(pb->pb_sv, pb->pb_col, pb->pb_row, &pp->sp, text, 0, 0);
+}
+
+
+static void *
+playback_thread(void *aux)
+{
+  sview_playback_t *pb = aux;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  pthread_mutex_lock(&pb->pb_mutex);
+  while(!pb->pb_closing) {
+    const int playing = __atomic_load_n(&pb->pb_playing, __ATOMIC_RELAXED);
+    const int seek = pb->pb_seek;
+
+    if(!playing && !seek) {
+      pthread_cond_wait(&pb->pb_cond, &pb->pb_mutex);
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      continue;
+    }
+
+    if(playing && !seek) {
+      if(pthread_cond_timedwait(&pb->pb_cond, &pb->pb_mutex,
+                                &deadline) == 0)
+        continue;
+    }
+
+    pb->pb_seek = 0;
+    unsigned int frame = __atomic_load_n(&pb->pb_frame, __ATOMIC_RELAXED);
+    frame = MIN(frame, pb->pb_num_frames - 1);
+
+    pb->pb_ra_pos = frame;
+    pb->pb_ra_pending = 1;
+    pthread_cond_broadcast(&pb->pb_cond);
+
+    pthread_mutex_unlock(&pb->pb_mutex);
+    playback_show(pb, frame);
+    pthread_mutex_lock(&pb->pb_mutex);
+
+    if(playing && !pb->pb_seek) {
+      // Don't race a frame the user just dragged to
+      __atomic_store_n(&pb->pb_frame, (frame + 1) % pb->pb_num_frames,
+                       __ATOMIC_RELAXED);
+    }
+
+    const int fps = MAX(1, __atomic_load_n(&pb->pb_fps, __ATOMIC_RELAXED));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline.tv_nsec += 1000000000 / fps;
+    if(deadline.tv_nsec >= 1000000000) {
+      deadline.tv_nsec -= 1000000000;
+      deadline.tv_sec++;
+    }
+    // If we fell behind (slow disk, paused) don't try to catch up
+    if(deadline.tv_sec < now.tv_sec ||
+       (deadline.tv_sec == now.tv_sec && deadline.tv_nsec < now.tv_nsec))
+      deadline = now;
+  }
+  pthread_mutex_unlock(&pb->pb_mutex);
+  return NULL;
+}
+
+
+static void
+playback_widget_updated(sview_widget_t *w)
+{
+  sview_playback_t *pb = w->opaque;
+  pthread_mutex_lock(&pb->pb_mutex);
+  if(w->value == &pb->pb_frame)
+    pb->pb_seek = 1;
+  pthread_cond_broadcast(&pb->pb_cond);
+  pthread_mutex_unlock(&pb->pb_mutex);
+}
+
+
+void
+sview_playback_widgets(sview_playback_t *pb, sview_widget_t *widgets)
+{
+  const sview_widget_t w[SVIEW_PLAYBACK_NUM_WIDGETS] = {
+    {
+      .name = "Frame",
+      .type = SVIEW_WIDGET_INT,
+      .min = 0,
+      .max = pb->pb_num_frames - 1,
+      .value = &pb->pb_frame,
+      .updated = playback_widget_updated,
+      .opaque = pb,
+    }, {
+      .name = "Playing",
+      .type = SVIEW_WIDGET_BOOL,
+      .value = &pb->pb_playing,
+      .updated = playback_widget_updated,
+      .opaque = pb,
+    }, {
+      .name = "FPS",
+      .type = SVIEW_WIDGET_INT,
+      .min = 1,
+      .max = 240,
+      .value = &pb->pb_fps,
+      .updated = playback_widget_updated,
+      .opaque = pb,
+    }
+  };
+  memcpy(widgets, w, sizeof(w));
+}
+
+
+sview_playback_t *
+sview_playback_open(const char *path, const sview_playback_raw_t *raw)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1)
+    return NULL;
+
+  struct stat st;
+  if(fstat(fd, &st) || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return NULL;
+
+  // Access pattern is decided by the read-ahead thread, not the kernel
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  sview_playback_t *pb = calloc(1, sizeof(sview_playback_t));
+  pb->pb_map = map;
+  pb->pb_map_size = st.st_size;
+  pb->pb_pagesize = sysconf(_SC_PAGESIZE);
+  pb->pb_refcount = 1;
+  pb->pb_fps = 25;
+
+  pthread_mutex_init(&pb->pb_mutex, NULL);
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&pb->pb_cond, &ca);
+  pthread_condattr_destroy(&ca);
+
+  int r;
+  if(pb->pb_map_size > 10 && !memcmp(pb->pb_map, "YUV4MPEG2 ", 10))
+    r = y4m_index(pb);
+  else if(pb->pb_map_size > 2 && pb->pb_map[0] == 'P' &&
+          (pb->pb_map[1] == '5' || pb->pb_map[1] == '6'))
+    r = pnm_index(pb);
+  else if(raw != NULL)
+    r = raw_index(pb, raw);
+  else
+    r = -1;
+
+  if(r) {
+    playback_release(pb);
+    return NULL;
+  }
+  return pb;
+}
+
+
+unsigned int
+sview_playback_num_frames(const sview_playback_t *pb)
+{
+  return pb->pb_num_frames;
+}
+
+
+void
+sview_playback_start(sview_playback_t *pb, sview_t *sv, int col, int row)
+{
+  if(pb->pb_running)
+    return;
+  pb->pb_sv = sv;
+  pb->pb_col = col;
+  pb->pb_row = row;
+  pb->pb_seek = 1;
+  pb->pb_running = 1;
+  pthread_create(&pb->pb_ra_tid, NULL, playback_readahead_thread, pb);
+  pthread_create(&pb->pb_play_tid, NULL, playback_thread, pb);
+}
+
+
+void
+sview_playback_close(sview_playback_t *pb)
+{
+  if(pb->pb_running) {
+    pthread_mutex_lock(&pb->pb_mutex);
+    pb->pb_closing = 1;
+    pthread_cond_broadcast(&pb->pb_cond);
+    pthread_mutex_unlock(&pb->pb_mutex);
+    pthread_join(pb->pb_play_tid, NULL);
+    pthread_join(pb->pb_ra_tid, NULL);
+  }
+  // Mapping stays around until the last frame on screen is released
+  playback_release(pb);
+}
@@ -0,0 +1,95 @@
+#include <sys/param.h>
+#include <string.h>
+
+#include "sview_pnm.h"
+
+
+/**
+ * Parse an unsigned decimal header field, skipping leading whitespace
+ * and '#' comments as netpbm does
+ */
+static int
+pnm_field(const uint8_t *p, size_t len, size_t *pos, unsigned int *value)
+{
+  size_t i = *pos;
+  while(i < len) {
+    if(p[i] == '#') {
+      while(i < len && p[i] != '\n')
+        i++;
+    } else if(p[i] == ' ' || p[i] == '\t' || p[i] == '\r' || p[i] == '\n') {
+      i++;
+    } else {
+      break;
+    }
+  }
+  if(i == len || p[i] < '0' || p[i] > '9')
+    return -1;
+
+  unsigned int v = 0;
+  while(i < len && p[i] >= '0' && p[i] <= '9') {
+    v = v * 10 + p[i] - '0';
+    if(v > 65535)
+      return -1;
+    i++;
+  }
+  *value = v;
+  *pos = i;
+  return 0;
+}
+
+
+long
+pnm_header_parse(const uint8_t *p, size_t len, pnm_header_t *h)
+{
+  if(len < 2 || p[0] != 'P' || (p[1] != '5' && p[1] != '6'))
+    return -1;
+
+  size_t pos = 2;
+  if(pnm_field(p, len, &pos, &h->width) ||
+     pnm_field(p, len, &pos, &h->height) ||
+     pnm_field(p, len, &pos, &h->maxval))
+    return -1;
+  // Single whitespace before raster
+  if(pos == len)
+    return -1;
+  pos++;
+
+  if(h->width == 0 || h->height == 0 || h->maxval == 0)
+    return -1;
+  h->pixfmt = p[1] == '5' ? SVIEW_PIXFMT_I : SVIEW_PIXFMT_RGB;
+  return pos;
+}
+
+
+size_t
+pnm_row_bytes(const pnm_header_t *h)
+{
+  return (size_t)h->width * sview_pixfmt_bpp(h->pixfmt) *
+    (h->maxval > 255 ? 2 : 1);
+}
+
+
+void
+pnm_row_to_8bit(uint8_t *dst, const uint8_t *src, size_t samples,
+                unsigned int maxval)
+{
+  if(maxval == 255) {
+    memcpy(dst, src, samples);
+    return;
+  }
+
+  // 255 / maxval in 8.24 fixed point, rounded. Samples above maxval
+  // are invalid, clamp them
+  const uint64_t mul = ((255ULL << 24) + maxval / 2) / maxval;
+  if(maxval > 255) {
+    for(size_t i = 0; i < samples; i++) {
+      const unsigned int v = MIN(src[i * 2] << 8 | src[i * 2 + 1], maxval);
+      dst[i] = (v * mul + (1 << 23)) >> 24;
+    }
+  } else {
+    for(size_t i = 0; i < samples; i++) {
+      const unsigned int v = MIN(src[i], maxval);
+      dst[i] = (v * mul + (1 << 23)) >> 24;
+    }
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "sview.h"
+
+/*
+ * Binary PGM (P5) and PPM (P6) helpers shared by the file loader and
+ * playback. Samples are scaled from 0 - maxval to 0 - 255, 16 bit
+ * samples (maxval > 255) are big endian as netpbm writes them.
+ */
+
+typedef struct pnm_header {
+  unsigned int width;
+  unsigned int height;
+  unsigned int maxval;
+  sview_pixfmt_t pixfmt;   // SVIEW_PIXFMT_I or SVIEW_PIXFMT_RGB
+} pnm_header_t;
+
+// Parse the header at the start of 'p'. Returns the offset of the
+// raster, or -1 if it's not a valid P5 / P6 header
+long pnm_header_parse(const uint8_t *p, size_t len, pnm_header_t *h);
+
+// Bytes per raster row
+size_t pnm_row_bytes(const pnm_header_t *h);
+
+// Scale one raster row of 'samples' samples into 8 bit
+void pnm_row_to_8bit(uint8_t *dst, const uint8_t *src, size_t samples,
+                     unsigned int maxval);
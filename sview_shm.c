@@ -0,0 +1,695 @@
+#define _GNU_SOURCE
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "sview.h"
+
+#define SHM_MAGIC    0x48535653 // 'SVSH'
+#define SHM_VERSION  1
+#define SHM_TEXT_MAX 128
+
+#define SHM_MAX_CONNS 64
+#define SHM_MAX_SLOTS 1024
+#define SHM_MAX_DIMENSION 16384
+
+// Connections accepted but not yet sent their memfd. The oldest is
+// dropped to make room, so idle connects can't lock anybody out
+#define SHM_MAX_HANDSHAKES 8
+
+/*
+ * Slot ownership is handed back and forth through ss_state:
+ *
+ *  FREE    -> WRITING   Producer claims slot (sview_shm_picture_alloc)
+ *  WRITING -> READY     Producer submits slot (sview_shm_put_picture)
+ *  READY   -> DISPLAY   Display process picks it up
+ *  DISPLAY -> FREE      Display process has uploaded or dropped it
+ */
+enum {
+  SLOT_FREE,
+  SLOT_WRITING,
+  SLOT_READY,
+  SLOT_DISPLAY,
+};
+
+typedef struct shm_slot {
+  uint32_t ss_state;
+  uint32_t ss_seq;
+  int32_t ss_col;
+  int32_t ss_row;
+  int32_t ss_flags;
+  int32_t ss_grid_size;
+  uint32_t ss_width;
+  uint32_t ss_height;
+  uint32_t ss_pixfmt;
+  int32_t ss_stride;
+  char ss_text[SHM_TEXT_MAX];
+} shm_slot_t;
+
+
+typedef struct shm_header {
+  uint32_t sh_magic;
+  uint32_t sh_version;
+  uint32_t sh_num_slots;
+  uint32_t sh_pad;
+  uint64_t sh_slot_size;
+  uint64_t sh_data_offset;
+  shm_slot_t sh_slots[];
+} shm_header_t;
+
+
+static uint8_t *
+slot_data(shm_header_t *sh, unsigned int slot)
+{
+  return (uint8_t *)sh + sh->sh_data_offset + slot * sh->sh_slot_size;
+}
+
+
+static int
+slot_cas(shm_slot_t *ss, uint32_t from, uint32_t to)
+{
+  return __atomic_compare_exchange_n(&ss->ss_state, &from, to, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+static void
+efd_signal(int fd)
+{
+  const uint64_t one = 1;
+  if(write(fd, &one, sizeof(one)) != sizeof(one)) {
+    // Counter overflow is harmless, reader will rescan all slots anyway
+  }
+}
+
+static void
+efd_drain(int fd)
+{
+  uint64_t v;
+  if(read(fd, &v, sizeof(v)) != sizeof(v)) {
+    // Spurious wakeup
+  }
+}
+
+
+static int
+stride_valid(unsigned int width, sview_pixfmt_t pixfmt, int stride)
+{
+  const int bpp = sview_pixfmt_bpp(pixfmt);
+  const uint64_t row_bytes = (uint64_t)width * bpp;
+  if(bpp == 0 || stride <= 0 || stride < row_bytes)
+    return 0;
+  // Rows must be describable by GL_UNPACK_ROW_LENGTH or
+  // GL_UNPACK_ALIGNMENT=4, see tex_set_pic()
+  return stride % bpp == 0 || stride == ((row_bytes + 3) & ~3);
+}
+
+
+
+/**********************************************************************
+ * Display side
+ */
+
+typedef struct shm_conn {
+  LIST_ENTRY(shm_conn) sc_link;
+  int sc_fd;
+  int sc_submit_efd;
+  int sc_release_efd;
+  shm_header_t *sc_hdr;
+  size_t sc_map_size;
+  int sc_refcount;
+
+  // Layout as validated at connect. The header stays writable by the
+  // producer, so it's never trusted again after that
+  unsigned int sc_num_slots;
+  size_t sc_slot_size;
+  size_t sc_data_offset;
+} shm_conn_t;
+
+
+typedef struct shm_server {
+  sview_t *ss_sv;
+  int ss_listen_fd;
+  LIST_HEAD(, shm_conn) ss_conns;
+  int ss_num_conns;
+} shm_server_t;
+
+
+typedef struct shm_picture {
+  sview_picture_t sp;
+  shm_conn_t *conn;
+  unsigned int slot;
+} shm_picture_t;
+
+
+static void
+shm_conn_release(shm_conn_t *sc)
+{
+  if(__atomic_sub_fetch(&sc->sc_refcount, 1, __ATOMIC_ACQ_REL))
+    return;
+  munmap(sc->sc_hdr, sc->sc_map_size);
+  close(sc->sc_submit_efd);
+  close(sc->sc_release_efd);
+  free(sc);
+}
+
+
+static void
+shm_picture_release(sview_picture_t *sp)
+{
+  shm_picture_t *p = (shm_picture_t *)sp;
+  shm_conn_t *sc = p->conn;
+  __atomic_store_n(&sc->sc_hdr->sh_slots[p->slot].ss_state, SLOT_FREE,
+                   __ATOMIC_RELEASE);
+  efd_signal(sc->sc_release_efd);
+  free(p);
+  shm_conn_release(sc);
+}
+
+
+static shm_conn_t *
+shm_conn_accept(int fd)
+{
+  char buf[16];
+  char cbuf[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = {buf, sizeof(buf)};
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = cbuf,
+    .msg_controllen = sizeof(cbuf),
+  };
+
+  if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+    return NULL;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+     cmsg->cmsg_type != SCM_RIGHTS ||
+     cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    return NULL;
+
+  int fds[3];
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  // Without a shrink seal the producer could truncate the memfd under
+  // us and turn the next upload into SIGBUS
+  struct stat st;
+  shm_header_t *sh = MAP_FAILED;
+  const int seals = fcntl(fds[0], F_GET_SEALS);
+  if(seals != -1 && (seals & F_SEAL_SHRINK) &&
+     fstat(fds[0], &st) == 0 && st.st_size >= sizeof(shm_header_t))
+    sh = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fds[0], 0);
+  close(fds[0]);
+
+  if(sh == MAP_FAILED)
+    goto bad;
+
+  const uint32_t magic = __atomic_load_n(&sh->sh_magic, __ATOMIC_RELAXED);
+  const uint32_t version = __atomic_load_n(&sh->sh_version, __ATOMIC_RELAXED);
+  const uint32_t num_slots =
+    __atomic_load_n(&sh->sh_num_slots, __ATOMIC_RELAXED);
+  const uint64_t slot_size =
+    __atomic_load_n(&sh->sh_slot_size, __ATOMIC_RELAXED);
+  const uint64_t data_offset =
+    __atomic_load_n(&sh->sh_data_offset, __ATOMIC_RELAXED);
+
+  const size_t slots_end = sizeof(shm_header_t) +
+    (size_t)num_slots * sizeof(shm_slot_t);
+
+  if(magic != SHM_MAGIC || version != SHM_VERSION ||
+     num_slots == 0 || num_slots > SHM_MAX_SLOTS ||
+     data_offset < slots_end ||
+     data_offset > st.st_size ||
+     slot_size > (st.st_size - data_offset) / num_slots) {
+    munmap(sh, st.st_size);
+    goto bad;
+  }
+
+  shm_conn_t *sc = calloc(1, sizeof(shm_conn_t));
+  sc->sc_fd = fd;
+  sc->sc_submit_efd = fds[1];
+  sc->sc_release_efd = fds[2];
+  sc->sc_hdr = sh;
+  sc->sc_map_size = st.st_size;
+  sc->sc_refcount = 1;
+  sc->sc_num_slots = num_slots;
+  sc->sc_slot_size = slot_size;
+  sc->sc_data_offset = data_offset;
+  return sc;
+
+ bad:
+  close(fds[1]);
+  close(fds[2]);
+  return NULL;
+}
+
+
+static int
+slot_seq_cmp(const void *A, const void *B)
+{
+  const shm_slot_t *a = *(const shm_slot_t **)A;
+  const shm_slot_t *b = *(const shm_slot_t **)B;
+  return (int32_t)(a->ss_seq - b->ss_seq);
+}
+
+
+static void
+shm_conn_submit(shm_server_t *srv, shm_conn_t *sc)
+{
+  shm_header_t *sh = sc->sc_hdr;
+  const unsigned int num_slots = sc->sc_num_slots;
+  shm_slot_t *ready[SHM_MAX_SLOTS];
+  int num_ready = 0;
+
+  efd_drain(sc->sc_submit_efd);
+
+  for(unsigned int i = 0; i < num_slots; i++) {
+    shm_slot_t *ss = &sh->sh_slots[i];
+    if(slot_cas(ss, SLOT_READY, SLOT_DISPLAY))
+      ready[num_ready++] = ss;
+  }
+
+  // Slots can be submitted in any order, present them in submit order
+  qsort(ready, num_ready, sizeof(ready[0]), slot_seq_cmp);
+
+  for(int i = 0; i < num_ready; i++) {
+    shm_slot_t *ss = ready[i];
+    const unsigned int slot = ss - sh->sh_slots;
+    // Read each field once, the producer may still scribble on them
+    const sview_pixfmt_t pixfmt = __atomic_load_n(&ss->ss_pixfmt,
+                                                  __ATOMIC_RELAXED);
+    const unsigned int width = __atomic_load_n(&ss->ss_width,
+                                               __ATOMIC_RELAXED);
+    const unsigned int height = __atomic_load_n(&ss->ss_height,
+                                                __ATOMIC_RELAXED);
+    const int stride = __atomic_load_n(&ss->ss_stride, __ATOMIC_RELAXED);
+    const int col = __atomic_load_n(&ss->ss_col, __ATOMIC_RELAXED);
+    const int row = __atomic_load_n(&ss->ss_row, __ATOMIC_RELAXED);
+    const int flags = __atomic_load_n(&ss->ss_flags, __ATOMIC_RELAXED);
+    const int grid_size = __atomic_load_n(&ss->ss_grid_size,
+                                          __ATOMIC_RELAXED);
+
+    if(col < 0 || row < 0 ||
+       width == 0 || height == 0 ||
+       width > SHM_MAX_DIMENSION || height > SHM_MAX_DIMENSION ||
+       !stride_valid(width, pixfmt, stride) ||
+       (uint64_t)stride * height > sc->sc_slot_size) {
+      __atomic_store_n(&ss->ss_state, SLOT_FREE, __ATOMIC_RELEASE);
+      efd_signal(sc->sc_release_efd);
+      continue;
+    }
+
+    char text[SHM_TEXT_MAX];
+    memcpy(text, ss->ss_text, sizeof(text));
+    text[SHM_TEXT_MAX - 1] = 0;
+
+    shm_picture_t *p = calloc(1, sizeof(shm_picture_t));
+    p->sp.width = width;
+    p->sp.height = height;
+    p->sp.pixfmt = pixfmt;
+    p->sp.planes[0] = (uint8_t *)sh + sc->sc_data_offset +
+      slot * sc->sc_slot_size;
+    p->sp.strides[0] = stride;
+    p->sp.release = shm_picture_release;
+    p->conn = sc;
+    p->slot = slot;
+    __atomic_add_fetch(&sc->sc_refcount, 1, __ATOMIC_ACQ_REL);
+
+    sview_put_picture(srv->ss_sv, col, row, &p->sp,
+                      text[0] ? text : NULL, flags, grid_size);
+  }
+}
+
+
+static void *
+shm_server_thread(void *aux)
+{
+  shm_server_t *ss = aux;
+  struct pollfd pfd[1 + SHM_MAX_HANDSHAKES + SHM_MAX_CONNS * 2];
+  shm_conn_t *conns[SHM_MAX_CONNS];
+  shm_conn_t *sc;
+  // Oldest first
+  int handshakes[SHM_MAX_HANDSHAKES];
+  int num_handshakes = 0;
+
+  while(1) {
+    int n = 0;
+    pfd[n++] = (struct pollfd){ss->ss_listen_fd, POLLIN};
+    for(int i = 0; i < num_handshakes; i++)
+      pfd[n++] = (struct pollfd){handshakes[i], POLLIN};
+    const int conn_base = n;
+    LIST_FOREACH(sc, &ss->ss_conns, sc_link) {
+      conns[(n - conn_base) / 2] = sc;
+      pfd[n++] = (struct pollfd){sc->sc_fd, POLLIN};
+      pfd[n++] = (struct pollfd){sc->sc_submit_efd, POLLIN};
+    }
+
+    if(poll(pfd, n, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      perror("sview: shm poll");
+      break;
+    }
+
+    for(int i = conn_base; i < n; i += 2) {
+      sc = conns[(i - conn_base) / 2];
+      if(pfd[i + 1].revents & POLLIN)
+        shm_conn_submit(ss, sc);
+
+      if(pfd[i].revents) {
+        // Producer has nothing more to say, so anything arriving on the
+        // socket (including EOF) means it's going away
+        LIST_REMOVE(sc, sc_link);
+        ss->ss_num_conns--;
+        close(sc->sc_fd);
+        shm_conn_release(sc);
+      }
+    }
+
+    // Only read the handshake once it's there, so a producer that
+    // connects and says nothing can't hold up the others
+    int kept = 0;
+    for(int i = 0; i < num_handshakes; i++) {
+      const int fd = handshakes[i];
+      if(!pfd[1 + i].revents) {
+        handshakes[kept++] = fd;
+        continue;
+      }
+      if(ss->ss_num_conns == SHM_MAX_CONNS ||
+         (sc = shm_conn_accept(fd)) == NULL) {
+        close(fd);
+        continue;
+      }
+      LIST_INSERT_HEAD(&ss->ss_conns, sc, sc_link);
+      ss->ss_num_conns++;
+    }
+    num_handshakes = kept;
+
+    if(pfd[0].revents & POLLIN) {
+      int fd = accept4(ss->ss_listen_fd, NULL, NULL,
+                       SOCK_CLOEXEC | SOCK_NONBLOCK);
+      if(fd == -1)
+        continue;
+      if(num_handshakes == SHM_MAX_HANDSHAKES) {
+        close(handshakes[0]);
+        memmove(handshakes, handshakes + 1,
+                (SHM_MAX_HANDSHAKES - 1) * sizeof(int));
+        num_handshakes--;
+      }
+      handshakes[num_handshakes++] = fd;
+    }
+  }
+
+  for(int i = 0; i < num_handshakes; i++)
+    close(handshakes[i]);
+
+  while((sc = LIST_FIRST(&ss->ss_conns)) != NULL) {
+    LIST_REMOVE(sc, sc_link);
+    close(sc->sc_fd);
+    shm_conn_release(sc);
+  }
+  close(ss->ss_listen_fd);
+  free(ss);
+  return NULL;
+}
+
+
+int
+sview_shm_serve(sview_t *sv, const char *path)
+{
+  struct sockaddr_un sun = {.sun_family = AF_UNIX};
+  if(strlen(path) >= sizeof(sun.sun_path))
+    return -1;
+  strcpy(sun.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd == -1)
+    return -1;
+
+  unlink(path);
+  if(bind(fd, (struct sockaddr *)&sun, sizeof(sun)) ||
+     listen(fd, 8)) {
+    close(fd);
+    return -1;
+  }
+
+  shm_server_t *ss = calloc(1, sizeof(shm_server_t));
+  ss->ss_sv = sv;
+  ss->ss_listen_fd = fd;
+  LIST_INIT(&ss->ss_conns);
+
+  pthread_t tid;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_create(&tid, &attr, shm_server_thread, ss);
+  pthread_attr_destroy(&attr);
+  return 0;
+}
+
+
+
+/**********************************************************************
+ * Producer side
+ */
+
+struct sview_shm_client {
+  int c_fd;
+  int c_submit_efd;
+  int c_release_efd;
+  shm_header_t *c_hdr;
+  size_t c_map_size;
+  uint32_t c_seq;
+};
+
+
+typedef struct shm_client_picture {
+  sview_picture_t sp;
+  sview_shm_client_t *client;
+  unsigned int slot;
+} shm_client_picture_t;
+
+
+sview_shm_client_t *
+sview_shm_connect(const char *path, unsigned int num_slots, size_t slot_size)
+{
+  struct sockaddr_un sun = {.sun_family = AF_UNIX};
+  if(strlen(path) >= sizeof(sun.sun_path) || num_slots == 0 ||
+     num_slots > SHM_MAX_SLOTS)
+    return NULL;
+  strcpy(sun.sun_path, path);
+
+  const size_t pagesize = sysconf(_SC_PAGESIZE);
+  slot_size = (slot_size + pagesize - 1) & ~(pagesize - 1);
+  const size_t data_offset =
+    (sizeof(shm_header_t) + num_slots * sizeof(shm_slot_t) +
+     pagesize - 1) & ~(pagesize - 1);
+  const size_t map_size = data_offset + num_slots * slot_size;
+
+  sview_shm_client_t *c = calloc(1, sizeof(sview_shm_client_t));
+  c->c_fd = -1;
+  c->c_submit_efd = eventfd(0, EFD_CLOEXEC);
+  c->c_release_efd = eventfd(0, EFD_CLOEXEC);
+  c->c_hdr = MAP_FAILED;
+  c->c_map_size = map_size;
+
+  // The display refuses memfds that could shrink under its mapping
+  int memfd = memfd_create("sview", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if(memfd == -1 || c->c_submit_efd == -1 || c->c_release_efd == -1 ||
+     ftruncate(memfd, map_size) ||
+     fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL))
+    goto bad;
+
+  c->c_hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  memfd, 0);
+  if(c->c_hdr == MAP_FAILED)
+    goto bad;
+
+  c->c_hdr->sh_magic = SHM_MAGIC;
+  c->c_hdr->sh_version = SHM_VERSION;
+  c->c_hdr->sh_num_slots = num_slots;
+  c->c_hdr->sh_slot_size = slot_size;
+  c->c_hdr->sh_data_offset = data_offset;
+
+  c->c_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(c->c_fd == -1 ||
+     connect(c->c_fd, (struct sockaddr *)&sun, sizeof(sun)))
+    goto bad;
+
+  const int fds[3] = {memfd, c->c_submit_efd, c->c_release_efd};
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {"sview", 5};
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = cbuf,
+    .msg_controllen = sizeof(cbuf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if(sendmsg(c->c_fd, &msg, MSG_NOSIGNAL) != iov.iov_len)
+    goto bad;
+
+  close(memfd);
+  return c;
+
+ bad:
+  if(memfd != -1)
+    close(memfd);
+  sview_shm_disconnect(c);
+  return NULL;
+}
+
+
+void
+sview_shm_disconnect(sview_shm_client_t *c)
+{
+  // The display process keeps its own mapping for as long as any of
+  // our pictures are on screen
+  if(c->c_hdr != MAP_FAILED)
+    munmap(c->c_hdr, c->c_map_size);
+  if(c->c_fd != -1)
+    close(c->c_fd);
+  if(c->c_submit_efd != -1)
+    close(c->c_submit_efd);
+  if(c->c_release_efd != -1)
+    close(c->c_release_efd);
+  free(c);
+}
+
+
+static void
+shm_client_picture_release(sview_picture_t *sp)
+{
+  shm_client_picture_t *p = (shm_client_picture_t *)sp;
+  sview_shm_client_t *c = p->client;
+  __atomic_store_n(&c->c_hdr->sh_slots[p->slot].ss_state, SLOT_FREE,
+                   __ATOMIC_RELEASE);
+  free(p);
+}
+
+
+static int
+shm_client_claim_slot(sview_shm_client_t *c)
+{
+  shm_header_t *sh = c->c_hdr;
+
+  while(1) {
+    for(unsigned int i = 0; i < sh->sh_num_slots; i++) {
+      if(slot_cas(&sh->sh_slots[i], SLOT_FREE, SLOT_WRITING))
+        return i;
+    }
+
+    // Wait for the display process to hand back a slot
+    struct pollfd pfd[2] = {
+      {c->c_release_efd, POLLIN},
+      {c->c_fd, POLLIN},
+    };
+    if(poll(pfd, 2, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      return -1;
+    }
+    if(pfd[1].revents)
+      return -1;
+    efd_drain(c->c_release_efd);
+  }
+}
+
+
+sview_picture_t *
+sview_shm_picture_alloc(sview_shm_client_t *c,
+                        unsigned int width, unsigned int height,
+                        sview_pixfmt_t pixfmt, int clear)
+{
+  const int bpp = sview_pixfmt_bpp(pixfmt);
+  if(bpp == 0 || width == 0 || height == 0)
+    return NULL;
+
+  const int align = 4;
+  const int stride = ((bpp * width) + (align - 1)) & ~(align - 1);
+  if((uint64_t)stride * height > c->c_hdr->sh_slot_size)
+    return NULL;
+
+  const int slot = shm_client_claim_slot(c);
+  if(slot == -1)
+    return NULL;
+
+  shm_client_picture_t *p = calloc(1, sizeof(shm_client_picture_t));
+  p->sp.width = width;
+  p->sp.height = height;
+  p->sp.pixfmt = pixfmt;
+  p->sp.planes[0] = slot_data(c->c_hdr, slot);
+  p->sp.strides[0] = stride;
+  p->sp.release = shm_client_picture_release;
+  p->client = c;
+  p->slot = slot;
+  if(clear)
+    memset(p->sp.planes[0], 0, stride * height);
+  return &p->sp;
+}
+
+
+void
+sview_shm_put_picture(sview_shm_client_t *c, int col, int row,
+                      sview_picture_t *picture,
+                      const char *text, int flags, int grid_size)
+{
+  shm_client_picture_t *p = (shm_client_picture_t *)picture;
+
+  if(picture->release != shm_client_picture_release || p->client != c) {
+    sview_picture_t *copy = sview_shm_picture_alloc(c, picture->width,
+                                                    picture->height,
+                                                    picture->pixfmt, 0);
+    if(copy != NULL) {
+      const size_t rowsize = picture->width *
+        sview_pixfmt_bpp(picture->pixfmt);
+      for(unsigned int y = 0; y < picture->height; y++)
+        memcpy(copy->planes[0] + y * copy->strides[0],
+               picture->planes[0] + y * picture->strides[0], rowsize);
+    }
+    picture->release(picture);
+    if(copy == NULL)
+      return;
+    p = (shm_client_picture_t *)copy;
+  }
+
+  shm_slot_t *ss = &c->c_hdr->sh_slots[p->slot];
+  ss->ss_seq = __atomic_add_fetch(&c->c_seq, 1, __ATOMIC_RELAXED);
+  ss->ss_col = col;
+  ss->ss_row = row;
+  ss->ss_flags = flags;
+  ss->ss_grid_size = grid_size;
+  ss->ss_width = p->sp.width;
+  ss->ss_height = p->sp.height;
+  ss->ss_pixfmt = p->sp.pixfmt;
+  ss->ss_stride = p->sp.strides[0];
+  if(text != NULL) {
+    strncpy(ss->ss_text, text, SHM_TEXT_MAX - 1);
+    ss->ss_text[SHM_TEXT_MAX - 1] = 0;
+  } else {
+    ss->ss_text[0] = 0;
+  }
+
+  __atomic_store_n(&ss->ss_state, SLOT_READY, __ATOMIC_RELEASE);
+  free(p);
+  efd_signal(c->c_submit_efd);
+}